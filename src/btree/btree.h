@@ -1,14 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <numeric>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <typeinfo>
+#include <utility>
+#include <vector>
 #include <format>
 #include "buffercache.h"
+#include "simd_search.h"
+#include "task.h"
 
 extern BufferCache BufferCacheInstance;
 
@@ -17,9 +29,33 @@ const uint16_t PageHeaderPadding = 0xEFEF;
 const uint16_t RootNode = 0x1;
 const uint16_t IntermediateNode = 0x2;
 const uint16_t LeafNode = 0x4;
-const uint16_t unUsed = 0x8; 
-const uint16_t exNodeTypeMask = ~(RootNode | IntermediateNode | LeafNode | unUsed);
+const uint16_t OverflowNode = 0x8;
+const uint16_t exNodeTypeMask = ~(RootNode | IntermediateNode | LeafNode | OverflowNode);
 const double MaxFillFactor = 0.9;
+// Nodes below this fill after a remove are merged with or refilled from a sibling
+const double MinFillFactor = 0.25;
+// Deepest tree remove keeps the path of
+const int MaxTreeHeight = 32;
+// A cursor moving this many leaves to the right in a row is taken for a scan
+const int ScanDetectHops = 2;
+// Leaves a scanning cursor reads ahead of itself
+const int ReadAheadLeaves = 32;
+
+// Record formats, stored in the compression bits 4-7 of _info. Pages of any format can be read,
+// new pages are created with DefaultRecordFormat.
+const uint16_t RecordFormatMask = 0xF0;
+// String lengths are 8 byte size_t
+const uint16_t FixedRecordFormat = 0x00;
+// String lengths are LEB128 varints
+const uint16_t VarintRecordFormat = 0x10;
+// Varint lengths, and string keys keep only their suffix after a prefix shared by the whole page
+const uint16_t PrefixRecordFormat = 0x20;
+const uint16_t DefaultRecordFormat = VarintRecordFormat;
+
+// _version bit set while a writer holds the page latched. Releasing the latch adds
+// LatchedVersionBit again, which clears it and carries into the modification count.
+const uint32_t LatchedVersionBit = 0x2;
+static_assert(LatchedVersionBit == PageLatchedBit);
 
 static void SetNodeType (uint16_t *info, uint16_t type) {
     *info &= exNodeTypeMask;
@@ -38,25 +74,37 @@ static bool IsLeafNode(uint16_t info) {
     return (info & LeafNode) == LeafNode;
 }
 
+static void SetRecordFormat(uint16_t *info, uint16_t format) {
+    *info &= ~RecordFormatMask;
+    *info |= format;
+}
+
+static uint16_t GetRecordFormat(uint16_t info) {
+    return info & RecordFormatMask;
+}
+
+static bool IsVarintFormat(uint16_t format) {
+    return format == VarintRecordFormat || format == PrefixRecordFormat;
+}
+
 struct BTreePagerHeader {
-    // 0-1  Node type: Root, Intermediate, Leaf
-    // 2-3  Lock mode: shared lock, exclusive lock, no lock
-    // 4-7 Compression mechanism: 0-None, ....
-    // 8-15 Resvered
+    // 0-3  Node type: Root, Intermediate, Leaf, Overflow
+    // 4-7 Compression mechanism: 0-None, 1-Varint string lengths, 2-Key prefix compression
+    // 8-15 Reserved and clear, the buffer cache marks the pages it stores compressed there
     uint16_t _info;
     
-    // Page version
-    uint16_t _version;
-    
-    // Effective fill factor of the current page
-    uint16_t _fillFactor;
-    
     // Number of the item pointers
     uint16_t _items_count;
     
+    // Page version for optimistic latching. It only grows, page resets and copies keep it.
+    uint32_t _version;
+    
     // The offset of top item slot. The slot is growing backward from page end.
     uint16_t _upper;
     
+    // Effective fill factor of the current page
+    uint16_t _fillFactor;
+    
     // Parent PID
     uint32_t _p_pid;
     
@@ -66,7 +114,7 @@ struct BTreePagerHeader {
     // Right sibling PID
     uint32_t _r_pid;
     
-    // Compression CRC checksum
+    // CRC32C of the page as the buffer cache last wrote it to the file
     uint32_t _crc;
     
     // Current page's PID
@@ -77,11 +125,139 @@ struct BTreePagerHeader {
     
     // Padding reserved
     uint16_t _padding;
+    
+    // Bytes of removed records left between the live records
+    uint16_t _free_space;
+
+    // LSN of the last logged change of the page, kept by a durable buffer cache
+    uint64_t _lsn;
 };
 
+static_assert(offsetof(BTreePagerHeader, _lsn) == PageLsnOffset);
+static_assert(offsetof(BTreePagerHeader, _version) == PageVersionOffset);
+static_assert(offsetof(BTreePagerHeader, _crc) == PageChecksumOffset);
+
 constexpr uint32_t BTreePagerHeaderSize = sizeof(BTreePagerHeader);
+static_assert(BTreePagerHeaderSize == 48);
 constexpr uint32_t MaxPageSlotSpace = PageSize - BTreePagerHeaderSize;
 
+// Clear the header except _version, which optimistic readers may be watching
+static void ClearPageHeader(BTreePagerHeader* header) {
+    constexpr auto versionEnd = offsetof(BTreePagerHeader, _version) + sizeof(uint32_t);
+    std::memset(header, 0, offsetof(BTreePagerHeader, _version));
+    std::memset((unsigned char*)header + versionEnd, 0, BTreePagerHeaderSize - versionEnd);
+}
+
+// Copy a whole page over dest, except dest's _version
+static void CopyPage(unsigned char* dest, const unsigned char* source) {
+    constexpr auto versionEnd = offsetof(BTreePagerHeader, _version) + sizeof(uint32_t);
+    std::memcpy(dest, source, offsetof(BTreePagerHeader, _version));
+    std::memcpy(dest + versionEnd, source + versionEnd, PageSize - versionEnd);
+}
+
+// Reset a page to an empty node of the given type
+static void InitBTreePage(unsigned char* page, uint32_t pid, uint16_t type, uint32_t parentPid) {
+    auto header = reinterpret_cast<BTreePagerHeader*>(page);
+    ClearPageHeader(header);
+    SetNodeType(&header->_info, type);
+    SetRecordFormat(&header->_info, DefaultRecordFormat);
+    header->_upper = PageSize;
+    header->_p_pid = parentPid;
+    header->_l_pid = InvalidPid;
+    header->_r_pid = InvalidPid;
+    header->_pid = pid;
+    header->_right_child_pid = InvalidPid;
+    header->_padding = PageHeaderPadding;
+}
+
+// Allocate a page from the buffer cache and initialize it as an empty node
+static unsigned char* AllocateBTreePage(uint16_t type, uint32_t parentPid) {
+    unsigned char* page;
+    auto pid = BufferCacheInstance.initNextFreePage(&page);
+    InitBTreePage(page, pid, type, parentPid);
+    return page;
+}
+
+static BTreePagerHeader* GetPageHeader(uint32_t pid) {
+    return reinterpret_cast<BTreePagerHeader*>(BufferCacheInstance.get(pid));
+}
+
+// Children are reparented a node at a time, they are not kept pinned for the whole operation
+static void SetParentPid(uint32_t pid, uint32_t parentPid) {
+    BufferCacheInstance.write(pid, offsetof(BTreePagerHeader, _p_pid), &parentPid, sizeof(parentPid));
+}
+
+// Relink the left sibling of a node whose latch the caller doesn't hold
+static void SetLeftPid(uint32_t pid, uint32_t leftPid) {
+    BufferCacheInstance.write(pid, offsetof(BTreePagerHeader, _l_pid), &leftPid, sizeof(leftPid));
+}
+
+// Start loading the header of a page and the first items after it into the cache
+static void PrefetchPage(const unsigned char* page) {
+    __builtin_prefetch(page);
+    __builtin_prefetch(page + 64);
+}
+
+// String values longer than this are kept in a chain of overflow pages. Their record only holds
+// the length, followed by the PID of the first overflow page.
+const size_t MaxInlineValueLength = PageSize / 4;
+
+// Write length bytes of a value to new overflow pages. Each page holds its part of the value
+// after the page header and links to the next page through _r_pid. Returns the first PID.
+static uint32_t WriteOverflowPages(const char* data, size_t length) {
+    uint32_t first = InvalidPid;
+    BTreePagerHeader* previous = nullptr;
+    for (size_t offset = 0; offset < length; offset += MaxPageSlotSpace) {
+        auto page = AllocateBTreePage(OverflowNode, InvalidPid);
+        std::memcpy(page + BTreePagerHeaderSize, data + offset, std::min(length - offset, (size_t)MaxPageSlotSpace));
+        auto header = reinterpret_cast<BTreePagerHeader*>(page);
+        if (previous == nullptr)
+            first = header->_pid;
+        else
+            previous->_r_pid = header->_pid;
+        previous = header;
+    }
+
+    return first;
+}
+
+// Read a value of length bytes from the overflow pages starting at pid. A page freed under an
+// optimistic reader still links to a valid PID or InvalidPid, so the walk stays in the cache.
+static std::string ReadOverflowPages(uint32_t pid, size_t length) {
+    std::string value(length, '\0');
+    for (size_t offset = 0; offset < length && pid != InvalidPid; offset += MaxPageSlotSpace) {
+        auto page = BufferCacheInstance.get(pid);
+        std::memcpy(value.data() + offset, page + BTreePagerHeaderSize, std::min(length - offset, (size_t)MaxPageSlotSpace));
+        pid = reinterpret_cast<BTreePagerHeader*>(page)->_r_pid;
+    }
+
+    return value;
+}
+
+static void FreeOverflowPages(uint32_t pid) {
+    while (pid != InvalidPid) {
+        auto next = GetPageHeader(pid)->_r_pid;
+        BufferCacheInstance.free(pid);
+        pid = next;
+    }
+}
+
+// Link a newly split sibling to the right of node
+static void LinkRightSibling(BTreePagerHeader* node, BTreePagerHeader* sibling) {
+    sibling->_l_pid = node->_pid;
+    sibling->_r_pid = node->_r_pid;
+    if (node->_r_pid != InvalidPid)
+        SetLeftPid(node->_r_pid, sibling->_pid);
+    node->_r_pid = sibling->_pid;
+}
+
+// Take sibling, the right sibling of node, out of the sibling chain before it is freed
+static void UnlinkRightSibling(BTreePagerHeader* node, BTreePagerHeader* sibling) {
+    node->_r_pid = sibling->_r_pid;
+    if (sibling->_r_pid != InvalidPid)
+        SetLeftPid(sibling->_r_pid, node->_pid);
+}
+
 // There 2 scenarios:
 // 1. Find the BTree node to insert, only pid will be set
 // 2. Find the value based on key, data will be set
@@ -96,229 +272,2095 @@ struct FindResult {
     FindResult(uint32_t p):pid(p) {}
 };
 
+// Number of bytes of the LEB128 encoding of value
+inline size_t getVarintSize(uint64_t value) {
+    size_t size = 1;
+    for (; value >= 0x80; value >>= 7)
+        size++;
+    return size;
+}
+
+// Write value 7 bits per byte, the high bit of a byte marks that more bytes follow.
+// Returns the number of bytes written.
+inline size_t writeVarint(uint64_t value, unsigned char* addr) {
+    size_t size = 0;
+    for (; value >= 0x80; value >>= 7)
+        addr[size++] = (unsigned char)(value | 0x80);
+    addr[size++] = (unsigned char)value;
+    return size;
+}
+
+// Returns the number of bytes read
+inline size_t readVarint(const unsigned char* addr, uint64_t* value) {
+    size_t size = 0;
+    *value = 0;
+    for (auto shift = 0; ; shift += 7) {
+        auto byte = addr[size++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return size;
+    }
+}
+
+// readVarint for a varint that ends before end. Reading stops at end, or after the most bytes a
+// 64 bit value takes, and returns the number of bytes read.
+inline size_t readVarint(const unsigned char* addr, const unsigned char* end, uint64_t* value) {
+    size_t size = 0;
+    *value = 0;
+    for (auto shift = 0; shift < 64 && addr + size < end; shift += 7) {
+        auto byte = addr[size++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            break;
+    }
+
+    return size;
+}
+
+// Read the length prefix of a serialized string. Returns the number of bytes of the prefix.
+inline size_t readStringLength(const unsigned char* addr, size_t* length, uint16_t format) {
+    if (IsVarintFormat(format)) {
+        uint64_t value;
+        auto size = readVarint(addr, &value);
+        *length = value;
+        return size;
+    }
+
+    std::memcpy(length, addr, sizeof(size_t));
+    return sizeof(size_t);
+}
+
+// readStringLength for a prefix that ends before end. A prefix cut off by end reads as length 0.
+inline size_t readStringLength(const unsigned char* addr, const unsigned char* end, size_t* length, uint16_t format) {
+    *length = 0;
+    if (addr >= end)
+        return 0;
+    if (IsVarintFormat(format)) {
+        uint64_t value;
+        auto size = readVarint(addr, end, &value);
+        *length = value;
+        return size;
+    }
+
+    if ((size_t)(end - addr) < sizeof(size_t))
+        return end - addr;
+    std::memcpy(length, addr, sizeof(size_t));
+    return sizeof(size_t);
+}
+
+// Write the length prefix of a serialized string. Returns the number of bytes written.
+inline size_t writeStringLength(size_t length, unsigned char* addr, uint16_t format) {
+    if (IsVarintFormat(format))
+        return writeVarint(length, addr);
+
+    std::memcpy(addr, &length, sizeof(size_t));
+    return sizeof(size_t);
+}
+
+// Customization point describing how a key or value type is laid out in a record. A codec has
+//   View       the type a serialized value is read back as when it is only compared or measured
+//   FixedSize  the bytes every value takes, 0 when they depend on the value
+//   size(data, format), write(data, addr, format) and read(addr, format), which returns a View
+// A codec of values of varying size also has read(addr, end, format), which reads nothing at or
+// past end. Pages are searched in place while writers may change them, so a length read torn
+// must not lead the read out of the page.
+// Types without a codec don't compile as keys or values, specialize BTreeCodec for others.
+template <typename T>
+constexpr bool HasNoCodec = false;
+
+template <typename T>
+struct BTreeCodec {
+    static_assert(HasNoCodec<T>, "Type is not supported");
+};
+
+// Trivial types such as numbers and POD structs are stored as their bytes
+template <typename T>
+    requires std::is_trivial_v<T> && std::is_standard_layout_v<T> && (!std::is_pointer_v<T>)
+struct BTreeCodec<T> {
+    using View = T;
+    static constexpr size_t FixedSize = sizeof(T);
+
+    static constexpr size_t size(const T&, uint16_t) { return sizeof(T); }
+
+    static void write(const T& data, unsigned char* addr, uint16_t) { std::memcpy(addr, &data, sizeof(T)); }
+
+    static T read(const unsigned char* addr, uint16_t) {
+        T data;
+        std::memcpy(&data, addr, sizeof(T));
+        return data;
+    }
+};
+
+// Strings are stored as their length prefix and bytes, and viewed in place on the page
+template <>
+struct BTreeCodec<std::string_view> {
+    using View = std::string_view;
+    static constexpr size_t FixedSize = 0;
+
+    static size_t size(std::string_view data, uint16_t format) {
+        if (IsVarintFormat(format))
+            return data.size() + getVarintSize(data.size());
+        return data.size() + sizeof(size_t);
+    }
+
+    static void write(std::string_view data, unsigned char* addr, uint16_t format) {
+        addr += writeStringLength(data.size(), addr, format);
+        std::memcpy(addr, data.data(), data.size());
+    }
+
+    static std::string_view read(const unsigned char* addr, uint16_t format) {
+        size_t length;
+        auto prefixSize = readStringLength(addr, &length, format);
+        return std::string_view(reinterpret_cast<const char*>(addr + prefixSize), length);
+    }
+
+    // The string is cut off at end
+    static std::string_view read(const unsigned char* addr, const unsigned char* end, uint16_t format) {
+        size_t length;
+        auto data = addr + readStringLength(addr, end, &length, format);
+        return std::string_view(reinterpret_cast<const char*>(data), data < end ? std::min<size_t>(length, end - data) : 0);
+    }
+};
+
+template <>
+struct BTreeCodec<std::string> : BTreeCodec<std::string_view> {};
+
+// Read a View of T from a page ending at end. A fixed size value that doesn't fit before end reads
+// as a value initialized View.
 template <typename T>
-inline void serialize(const T& data, unsigned char* addr) {
-    static_assert(std::is_same<T, int>::value || std::is_same<T, std::string>::value ||
-                  std::is_same<T, float>::value || std::is_same<T, double>::value ||
-                  std::is_same<T, long double>::value || std::is_same<T, bool>::value ||
-                  std::is_same<T, long>::value || std::is_same<T, long long>::value,
-                  "Type is not supported");
+inline typename BTreeCodec<T>::View deserializeView(const unsigned char* addr, const unsigned char* end, uint16_t format) {
+    if constexpr (BTreeCodec<T>::FixedSize != 0) {
+        if (addr > end || (size_t)(end - addr) < BTreeCodec<T>::FixedSize)
+            return typename BTreeCodec<T>::View{};
+        return BTreeCodec<T>::read(addr, format);
+    } else
+        return BTreeCodec<T>::read(addr, end, format);
+}
+
+// Tuples are stored as their elements one after the other and read back as a tuple of the views
+// of the elements, so composite keys compare without copying their strings out of the page
+template <typename... Ts>
+struct BTreeCodec<std::tuple<Ts...>> {
+    using View = std::tuple<typename BTreeCodec<Ts>::View...>;
+    static constexpr size_t FixedSize = ((BTreeCodec<Ts>::FixedSize != 0) && ...) ? (BTreeCodec<Ts>::FixedSize + ... + 0) : 0;
+
+    // data is the tuple or its View
+    template <typename TTuple>
+    static size_t size(const TTuple& data, uint16_t format) {
+        if constexpr (FixedSize != 0)
+            return FixedSize;
+        else
+            return std::apply([format](const auto&... elements) { return (BTreeCodec<Ts>::size(elements, format) + ... + 0); }, data);
+    }
+
+    template <typename TTuple>
+    static void write(const TTuple& data, unsigned char* addr, uint16_t format) {
+        std::apply([&](const auto&... elements) {
+            ((BTreeCodec<Ts>::write(elements, addr, format), addr += BTreeCodec<Ts>::size(elements, format)), ...);
+        }, data);
+    }
+
+    static View read(const unsigned char* addr, uint16_t format) {
+        // a braced list reads the elements in order
+        return View{readElement<Ts>(addr, format)...};
+    }
+
+    static View read(const unsigned char* addr, const unsigned char* end, uint16_t format) {
+        return View{readElement<Ts>(addr, end, format)...};
+    }
+
+private:
+    template <typename T>
+    static typename BTreeCodec<T>::View readElement(const unsigned char*& addr, uint16_t format) {
+        auto element = BTreeCodec<T>::read(addr, format);
+        addr += BTreeCodec<T>::size(element, format);
+        return element;
+    }
 
-    if constexpr (std::is_same_v<T, std::string>) {
-        auto str_size = data.size();
-        std::memcpy(addr, &str_size, sizeof(size_t));
-        std::memcpy(addr + sizeof(size_t), data.data(), str_size);
-    } else {
-        std::memcpy(addr, &data, sizeof(T));
+    template <typename T>
+    static typename BTreeCodec<T>::View readElement(const unsigned char*& addr, const unsigned char* end, uint16_t format) {
+        auto element = deserializeView<T>(addr, end, format);
+        addr += BTreeCodec<T>::size(element, format);
+        return element;
     }
+};
+
+// Whether every value of T takes the same number of bytes, known at compile time
+template <typename T>
+constexpr bool IsFixedSize = BTreeCodec<T>::FixedSize != 0;
+
+template <typename T>
+inline void serialize(const T& data, unsigned char* addr, uint16_t format = FixedRecordFormat) {
+    BTreeCodec<T>::write(data, addr, format);
 }
 
+// Type a serialized value is read back as when it is only compared or measured
+template <typename T>
+struct SerializedView { using type = typename BTreeCodec<T>::View; };
+
 template <typename T>
-inline const T deserialize(unsigned char* addr) {
-    if constexpr (std::is_same_v<T, std::string>)
-        return std::string(reinterpret_cast<const char*>(addr + sizeof(size_t)), *addr);
-    else
-        return *(reinterpret_cast<T*>(addr));
+inline typename SerializedView<T>::type deserializeView(const unsigned char* addr, uint16_t format = FixedRecordFormat) {
+    return BTreeCodec<T>::read(addr, format);
 }
 
 template <typename T>
-inline const size_t getSerializedSize(const T& data) { 
-    if constexpr (std::is_same_v<T, std::string>) 
-        return data.size() + sizeof(size_t);
-    else
-        return sizeof(T); 
+inline const T deserialize(const unsigned char* addr, uint16_t format = FixedRecordFormat) {
+    return T(deserializeView<T>(addr, format));
 }
 
-// BTree node maps to a BTree page which has a fixed length of 8k
-template <typename TKey, typename TVal>
-class BTreeNode {
+template <typename T>
+inline const T deserialize(const unsigned char* addr, const unsigned char* end, uint16_t format) {
+    return T(deserializeView<T>(addr, end, format));
+}
+
+template <typename T>
+inline const size_t getSerializedSize(const T& data, uint16_t format = FixedRecordFormat) {
+    return BTreeCodec<T>::size(data, format);
+}
+
+inline size_t getCommonPrefixLength(std::string_view a, std::string_view b) {
+    size_t length = 0;
+    auto limit = std::min(a.size(), b.size());
+    while (length < limit && a[length] == b[length])
+        length++;
+    return length;
+}
+
+// Signed 32 and 64 bit keys are stored in a dense sorted array searched with SIMD
+template <typename T>
+constexpr bool IsDenseKey = std::is_integral_v<T> && std::is_signed_v<T> && (sizeof(T) == 4 || sizeof(T) == 8);
+
+// Slotted page layout shared by leaf and intermediate nodes. The item offset array grows forward
+// from the header and the records grow backward from the page end.
+// A PrefixRecordFormat page keeps its key prefix at the very end of the page, followed by the
+// uint16_t prefix length, and the records grow backward from below the prefix.
+// Dense key pages keep the keys out of the records: the header is followed by keys[_items_count]
+// and then the item offset array, and records only hold the value or child PID.
+template <typename TKey>
+class BTreePage {
 public:    
-    uint32_t insert(const TKey& key, const TVal& value, bool foundNode = false) {
-        if (!foundNode) {
-            auto findResult = find(key, true);
-            assert(findResult.pid != InvalidPid);
-            
-            if (findResult.pid != _header._pid) {
-                auto pLeafNode = reinterpret_cast<BTreeNode<TKey,TVal>*>(BufferCacheInstance.get(findResult.pid));
-                return pLeafNode->insert(key, value, true);
-            }
+    static constexpr bool DenseKeys = IsDenseKey<TKey>;
+
+    // Offset array entry plus, on dense key pages, the key array entry
+    static constexpr size_t SlotSize = sizeof(uint16_t) + (DenseKeys ? sizeof(TKey) : 0);
+
+    BTreePagerHeader* getHeader() { return &_header; }
+
+    bool isLeaf() { return IsLeafNode(_header._info); }
+
+    uint16_t getRecordFormat() { return GetRecordFormat(_header._info); }
+
+    // Change the record format of an empty page
+    void setRecordFormat(uint16_t format) {
+        if (_header._items_count > 0)
+            throw std::runtime_error("Record format can only change on an empty page");
+        if (format == PrefixRecordFormat && !std::is_same_v<TKey, std::string>)
+            throw std::runtime_error("Prefix compression requires string keys");
+
+        SetRecordFormat(&_header._info, format);
+        resetItems();
+    }
+
+    // Optimistic lock coupling. Readers take readVersion() before reading the page and check
+    // validate() afterwards, restarting when a writer changed the page in between. Writers latch
+    // a page with tryUpgrade() from a version they read and bump the version in writeUnlock().
+    // A durable buffer cache logs what changed in between.
+
+    // Page version once no writer holds the latch
+    uint32_t readVersion() {
+        std::atomic_ref<uint32_t> version(_header._version);
+        auto current = version.load(std::memory_order_acquire);
+        while (current & LatchedVersionBit) {
+            std::this_thread::yield();
+            current = version.load(std::memory_order_acquire);
         }
-        
-        // if we are over the fill factor, split the node and insert into the new node
-        // recursively insert the split key into parent node
-        auto needSplit = false;
-        auto freeSpace = MaxPageSlotSpace - (_header._items_count * sizeof(uint16_t) + (PageSize - _header._upper));
-        if (1.0 - (double)freeSpace / MaxPageSlotSpace > MaxFillFactor) {
-            needSplit = true;
-        } else if (sizeof(key) + sizeof(value) >= freeSpace) {
-            needSplit = true;
-        }
-        
-        if (needSplit) {
-            std::runtime_error("Split not implemented yet");
-        } else {
-            // insert into the slot by growing the _upper offset
-            auto keySize = getSerializedSize(key);
-            auto valueSize = getSerializedSize(value);
-            auto currentPtr = reinterpret_cast<unsigned char*>((unsigned char*)this + _header._upper - (keySize + valueSize));
-            serialize(key, currentPtr);
-            currentPtr += keySize;
-            serialize(value, currentPtr);
-            _header._upper -= keySize + valueSize;
-            
-            // insert into the item offset array by using binary search to find the position.
-            bool append = false;
-            auto pos = findItemInsertPosition(key, &append);
-            auto srcPtr =  reinterpret_cast<unsigned char*>(((unsigned char*)this + BTreePagerHeaderSize) + pos * sizeof(uint16_t));
-            if (!append && _header._items_count - pos > 0)
-                std::memcpy(srcPtr + sizeof(uint16_t), srcPtr, (_header._items_count - pos) * sizeof(uint16_t));
-
-            uint16_t *upperPtr = reinterpret_cast<uint16_t*>(srcPtr);
-            *upperPtr = _header._upper;
-            _header._items_count++;
-        }
-        
-        return _header._pid;
+
+        return current;
     }
-    
-    FindResult<TVal> find(const TKey& key, bool forInsert) {
-        auto found = false;
-        auto low = 0, mid = -1, high = _header._items_count - 1;
-        while (low <= high) {
-            mid = (low + high) / 2;
-            auto midKey = getItemKeyValue(mid, nullptr);
-            if (key > midKey)
-                low = mid + 1;
-            else if (key < midKey)
-                high = mid - 1;
-            else {
-                low = mid;
-                found = true;
-                break;
+
+    // Whether the page is unchanged since version was read
+    bool validate(uint32_t version) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return std::atomic_ref<uint32_t>(_header._version).load(std::memory_order_relaxed) == version;
+    }
+
+    // Latch the page if it is still at version
+    bool tryUpgrade(uint32_t version) {
+        if (!std::atomic_ref<uint32_t>(_header._version).compare_exchange_strong(version, version | LatchedVersionBit, std::memory_order_acquire))
+            return false;
+
+        BufferCacheInstance.beginWrite((unsigned char*)this);
+        return true;
+    }
+
+    // Bytes taken by the live items, prefix area included
+    size_t getUsedSpace() {
+        return _header._items_count * SlotSize + (PageSize - _header._upper) - _header._free_space;
+    }
+
+    bool isUnderfull() { return getUsedSpace() < MinFillFactor * MaxPageSlotSpace; }
+
+    // Latch the page unless a writer holds it already
+    bool tryWriteLock() {
+        auto version = std::atomic_ref<uint32_t>(_header._version).load(std::memory_order_relaxed);
+        return !(version & LatchedVersionBit) && tryUpgrade(version);
+    }
+
+    // Latch the page, waiting for the writer holding it. For writers that have the tree to
+    // themselves, such as bulk loading.
+    void writeLock() {
+        while (!tryWriteLock())
+            std::this_thread::yield();
+    }
+
+    void writeUnlock() {
+        BufferCacheInstance.endWrite((unsigned char*)this);
+        std::atomic_ref<uint32_t>(_header._version).fetch_add(LatchedVersionBit, std::memory_order_release);
+    }
+
+    // Prefix shared by all keys of a PrefixRecordFormat page, empty for other formats. A torn
+    // length stays behind the header.
+    std::string_view getKeyPrefix() {
+        if (getRecordFormat() != PrefixRecordFormat)
+            return std::string_view();
+
+        uint16_t length;
+        std::memcpy(&length, (unsigned char*)this + PageSize - sizeof(uint16_t), sizeof(uint16_t));
+        length = std::min<uint16_t>(length, MaxPageSlotSpace - sizeof(uint16_t));
+        return std::string_view((const char*)this + PageSize - sizeof(uint16_t) - length, length);
+    }
+
+    // Put the offsets of the items stageItem() appended behind the keys
+    void placeOffsets(const uint16_t* offsets) {
+        std::memcpy(getOffsetArray(), offsets, _header._items_count * sizeof(uint16_t));
+    }
+
+protected:
+    TKey* getKeyArray() { return reinterpret_cast<TKey*>((unsigned char*)this + BTreePagerHeaderSize); }
+
+    uint16_t* getOffsetArray() {
+        auto addr = (unsigned char*)this + BTreePagerHeaderSize;
+        if constexpr (DenseKeys)
+            addr += _header._items_count * sizeof(TKey);
+        return reinterpret_cast<uint16_t*>(addr);
+    }
+
+    const unsigned char* getPageEnd() { return (unsigned char*)this + PageSize; }
+
+    // Offsets are below PageSize, the mask keeps a torn optimistic read inside the page
+    unsigned char* getItemPtr(uint16_t index) {
+        return (unsigned char*)this + (getOffsetArray()[index] & (PageSize - 1));
+    }
+
+    // Address of the record part following the key
+    unsigned char* getItemValuePtr(uint16_t index) {
+        auto ptr = getItemPtr(index);
+        if constexpr (DenseKeys)
+            return ptr;
+        else if constexpr (IsFixedSize<TKey>)
+            return ptr + BTreeCodec<TKey>::FixedSize;
+        else
+            return ptr + getSerializedSize(getItemKeyView(index), getRecordFormat());
+    }
+
+    const TKey getItemKey(uint16_t index) {
+        if constexpr (DenseKeys)
+            return getKeyArray()[index];
+        if constexpr (std::is_same_v<TKey, std::string>) {
+            if (getRecordFormat() == PrefixRecordFormat) {
+                std::string key(getKeyPrefix());
+                key.append(getItemKeyView(index));
+                return key;
             }
         }
-        
-        if (isLeaf()) {
-            if (!forInsert) {
-                if (found) {
-                    TVal data;
-                    getItemKeyValue(low, &data);
-                    return FindResult<TVal>(_header._pid, data);
-                } else
-                    return FindResult<TVal>(InvalidPid);
-            }
-            else 
-                return FindResult<TVal>(_header._pid);
-        } else {
-            auto pid = InvalidPid;
-            if (low > _header._items_count - 1)
-                pid = _header._right_child_pid;
-            else {
-                TVal data;
-                getItemKeyValue(low, &data);
-                // pid = (uint32_t)data; TODO: for intermediate node the data type must be dynamic cast or will fail compiling.
+
+        return deserialize<TKey>(getItemPtr(index), getPageEnd(), getRecordFormat());
+    }
+
+    // Key at index without copying it out of the page, used by the search paths. On a
+    // PrefixRecordFormat page this is the key suffix. It is cut off at the page end, where
+    // optimistic readers may find a torn length.
+    typename SerializedView<TKey>::type getItemKeyView(uint16_t index) {
+        if constexpr (DenseKeys)
+            return getKeyArray()[index];
+        else
+            return deserializeView<TKey>(getItemPtr(index), getPageEnd(), getRecordFormat());
+    }
+
+    // Serialized size of key in the record. The key must start with the page prefix.
+    size_t getKeySize(const TKey& key) {
+        if constexpr (DenseKeys)
+            return 0;
+        else if constexpr (std::is_same_v<TKey, std::string>)
+            return getSerializedSize(std::string_view(key).substr(getKeyPrefix().size()), getRecordFormat());
+        else
+            return getSerializedSize(key, getRecordFormat());
+    }
+
+    // Serialize key without the page prefix. Returns the serialized size.
+    size_t serializeKey(const TKey& key, unsigned char* addr) {
+        if constexpr (std::is_same_v<TKey, std::string>) {
+            if (getRecordFormat() == PrefixRecordFormat) {
+                auto suffix = std::string_view(key).substr(getKeyPrefix().size());
+                auto size = writeVarint(suffix.size(), addr);
+                std::memcpy(addr + size, suffix.data(), suffix.size());
+                return size + suffix.size();
             }
-            auto pNode = reinterpret_cast<BTreeNode<TKey,TVal>*>(BufferCacheInstance.get(pid));
-            return pNode->find(key, forInsert);
         }
+
+        serialize(key, addr, getRecordFormat());
+        return getSerializedSize(key, getRecordFormat());
     }
 
-    bool remove(const TKey& key) { 
-        // TODO: 
-        return true;
+    bool coversKey(const TKey& key) {
+        if constexpr (std::is_same_v<TKey, std::string>)
+            return std::string_view(key).starts_with(getKeyPrefix());
+        else
+            return true;
     }
-    
-    void to_string() {
-        std::string nodeType;
-        if ((getHeader()._info & RootNode) == RootNode)
-            nodeType = "Root";
-        if ((getHeader()._info & IntermediateNode) == IntermediateNode)
-            nodeType = "Intermediate";
-        if ((getHeader()._info & LeafNode) == LeafNode) {
-            if (nodeType.size() > 0)
-                nodeType.append(" Leaf");
-            else
-                nodeType = "Leaf";
-        }
-        
-        if (nodeType.size() == 0)
-            throw std::runtime_error("Invalid node type:");
-        
-        std::cout<<"=========="<<getHeader()._pid<<"==========="<<std::endl;
-        std::cout<<"Type:"<<nodeType<<std::endl;
-        std::cout<<"Items Count:"<<getHeader()._items_count<<std::endl;
-        std::cout<<"Parent:"<<getHeader()._p_pid<<std::endl;
-        std::cout<<"Left Sibling:"<<getHeader()._l_pid<<std::endl;
-        std::cout<<"Right Sibling:"<<getHeader()._r_pid<<std::endl;
-        std::cout<<"Slot Offset:"<<getHeader()._upper<<std::endl;
-        std::cout<<"Right Child:"<<getHeader()._right_child_pid<<std::endl;
-        std::cout<<"Keys:"<<std::endl;
-        
-        auto ptr_base = (unsigned char*)(this) + BTreePagerHeaderSize;
-        for (auto i = 0; i < getHeader()._items_count; i++) {
-            auto item_offset = *((uint16_t*)(ptr_base + i * sizeof(uint16_t)));
-            auto ptr_current = (unsigned char*)(this) + item_offset;
-            auto key = deserialize<TKey>(ptr_current);
-            std::cout<<i<<"  "<<"Key:"<<key<<" "<<"Val:"<<deserialize<TVal>(ptr_current + getSerializedSize(key))<<std::endl;
-        }
+
+    // Removed records don't count, compact() takes their space back before the page splits
+    bool needSplit(size_t itemSize) {
+        auto freeSpace = MaxPageSlotSpace - getUsedSpace();
+        if (1.0 - (double)freeSpace / MaxPageSlotSpace > MaxFillFactor)
+            return true;
+
+        return itemSize + SlotSize > freeSpace;
     }
 
-    void set_header(const BTreePagerHeader& header) { _header = header; }
+    // Whether an item fits without taking the page over fillFactor. An empty page always takes
+    // an item that fits physically.
+    bool fits(size_t itemSize, double fillFactor) {
+        auto usedSpace = getUsedSpace();
+        if (_header._items_count == 0)
+            return usedSpace + itemSize + SlotSize <= MaxPageSlotSpace;
 
-    BTreePagerHeader* getHeader() { return &_header; }
+        return usedSpace + itemSize + SlotSize <= fillFactor * MaxPageSlotSpace;
+    }
 
-private:
-    // Find the key based on item array's position
-    const TKey getItemKeyValue (uint16_t index, TVal* data) {
-        auto addr =  reinterpret_cast<unsigned char*>(((unsigned char*)this + BTreePagerHeaderSize) + index * sizeof(uint16_t));
-        auto keyOffset = reinterpret_cast<uint16_t*>(addr);
-        auto key = deserialize<TKey>(reinterpret_cast<unsigned char*>((unsigned char*)this + *keyOffset));
-        if (data != nullptr) {
-            auto dataOffset = *keyOffset + getSerializedSize(key);
-            *data = deserialize<TVal>(reinterpret_cast<unsigned char*>((unsigned char*)this + dataOffset));
+    // Bytes between the end of the offset array and the lowest record
+    size_t getGapSize() {
+        return _header._upper - BTreePagerHeaderSize - _header._items_count * SlotSize;
+    }
+
+    // Whether an item only fits between the offsets and the records after compact()
+    bool needsCompaction(size_t itemSize) {
+        return _header._free_space > 0 && itemSize + SlotSize > getGapSize();
+    }
+
+    // Move the live records next to each other at the end of the record area, from the highest
+    // offset down, and give the space of removed records back to _upper. itemSize(index) is the
+    // record size of the item at index.
+    template <typename TItemSize>
+    void compact(TItemSize&& itemSize) {
+        uint16_t order[MaxPageSlotSpace / sizeof(uint16_t)];
+        auto count = _header._items_count;
+        auto offsets = getOffsetArray();
+        for (uint16_t i = 0; i < count; i++)
+            order[i] = i;
+        std::sort(order, order + count, [offsets](uint16_t a, uint16_t b) { return offsets[a] > offsets[b]; });
+
+        uint16_t upper = PageSize;
+        if (getRecordFormat() == PrefixRecordFormat)
+            upper -= getKeyPrefix().size() + sizeof(uint16_t);
+        for (uint16_t i = 0; i < count; i++) {
+            auto index = order[i];
+            auto size = itemSize(index);
+            upper -= size;
+            if (upper != offsets[index])
+                std::memmove((unsigned char*)this + upper, (unsigned char*)this + offsets[index], size);
+            offsets[index] = upper;
         }
 
-        return key;
+        _header._upper = upper;
+        _header._free_space = 0;
     }
 
-    bool isLeaf() { return true; }
-    
-    uint16_t findItemInsertPosition(const TKey& key, bool* append) {
-        auto low = 0;
-        auto high = _header._items_count - 1;
-        *append = false;
+    // Reserve itemSize bytes by growing the _upper offset downward and insert its offset into
+    // the item offset array at pos. On a dense key page the offset array moves up by one key to
+    // open the key slot at pos. Returns the address to serialize the record into.
+    unsigned char* allocateSlot(uint16_t pos, size_t itemSize) {
+        _header._upper -= itemSize;
+        auto count = _header._items_count;
+        auto offsets = getOffsetArray();
+        if constexpr (DenseKeys) {
+            // move the tail first, the head then lands on the tail's old place
+            auto moved = reinterpret_cast<uint16_t*>((unsigned char*)offsets + sizeof(TKey));
+            std::memmove(moved + pos + 1, offsets + pos, (count - pos) * sizeof(uint16_t));
+            std::memmove(moved, offsets, pos * sizeof(uint16_t));
+            auto keys = getKeyArray();
+            std::memmove(keys + pos + 1, keys + pos, (count - pos) * sizeof(TKey));
+            offsets = moved;
+        } else if (count - pos > 0)
+            std::memmove(offsets + pos + 1, offsets + pos, (count - pos) * sizeof(uint16_t));
 
-        if (high < 0) {
-            *append = true;
-            return 0;
+        offsets[pos] = _header._upper;
+        _header._items_count++;
+        return (unsigned char*)this + _header._upper;
+    }
+
+    // Allocate an item for key at pos and store the key. itemSize includes getKeySize(key).
+    // Returns the address to serialize the value into.
+    unsigned char* allocateItem(uint16_t pos, const TKey& key, size_t itemSize) {
+        auto ptr = allocateSlot(pos, itemSize);
+        if constexpr (DenseKeys) {
+            std::memcpy(getKeyArray() + pos, &key, sizeof(TKey));
+            return ptr;
+        } else
+            return ptr + serializeKey(key, ptr);
+    }
+
+    // Append an item for key to a dense key page being filled in key order from empty. Its offset
+    // goes to offsets[count] instead of the page, so the offset array doesn't move up with every
+    // appended key, and placeOffsets() puts them all in place once. Returns the address to
+    // serialize the value into.
+    unsigned char* stageItem(const TKey& key, size_t itemSize, uint16_t* offsets) {
+        _header._upper -= itemSize;
+        offsets[_header._items_count] = _header._upper;
+        std::memcpy(getKeyArray() + _header._items_count, &key, sizeof(TKey));
+        _header._items_count++;
+        return (unsigned char*)this + _header._upper;
+    }
+
+    // Drop the item at pos, whose record takes itemSize bytes. The record space is reclaimed
+    // right away when it is the lowest record, otherwise it is counted in _free_space.
+    void removeItem(uint16_t pos, size_t itemSize) {
+        auto count = _header._items_count;
+        auto offsets = getOffsetArray();
+        auto offset = offsets[pos];
+        if constexpr (DenseKeys) {
+            // the keys close the gap first, then the offset array moves down into the freed key
+            auto keys = getKeyArray();
+            std::memmove(keys + pos, keys + pos + 1, (count - pos - 1) * sizeof(TKey));
+            auto moved = reinterpret_cast<uint16_t*>((unsigned char*)offsets - sizeof(TKey));
+            std::memmove(moved, offsets, pos * sizeof(uint16_t));
+            std::memmove(moved + pos, offsets + pos + 1, (count - pos - 1) * sizeof(uint16_t));
+        } else
+            std::memmove(offsets + pos, offsets + pos + 1, (count - pos - 1) * sizeof(uint16_t));
+
+        _header._items_count--;
+        if (_header._items_count == 0)
+            resetItems(getKeyPrefix());
+        else if (offset == _header._upper)
+            _header._upper += itemSize;
+        else
+            _header._free_space += itemSize;
+    }
+
+    // Append a copy of the item at index of source, whose record format matches this page
+    void appendItem(BTreePage<TKey>* source, uint16_t index, size_t itemSize) {
+        auto ptr = allocateSlot(_header._items_count, itemSize);
+        if constexpr (DenseKeys)
+            getKeyArray()[_header._items_count - 1] = source->getKeyArray()[index];
+        std::memcpy(ptr, source->getItemPtr(index), itemSize);
+    }
+
+    // Drop all items so the page can be rebuilt from a copy of itself. A PrefixRecordFormat
+    // page starts over with the given key prefix.
+    void resetItems(std::string_view prefix = std::string_view()) {
+        _header._items_count = 0;
+        _header._free_space = 0;
+        _header._upper = PageSize;
+        if (getRecordFormat() == PrefixRecordFormat) {
+            uint16_t length = prefix.size();
+            _header._upper -= sizeof(uint16_t) + length;
+            if (length > 0)
+                std::memmove((unsigned char*)this + _header._upper, prefix.data(), length);
+            std::memcpy((unsigned char*)this + PageSize - sizeof(uint16_t), &length, sizeof(uint16_t));
         }
-        else if (key > getItemKeyValue(high, nullptr)) {
-            *append = true;
-            return high + 1;
-        } else if (key < getItemKeyValue(low, nullptr)) {
-            return low;
-        } else {
-            auto mid = (low + high) / 2;
-            while (low <= high) {
-                mid = (low + high) / 2;
-                auto midKey = getItemKeyValue(mid, nullptr);
-                if (key > midKey)
-                    low = mid + 1;
-                else if (key < midKey)
-                    high = mid - 1;
-                else {
-                    low = mid;
-                    break;
+    }
+
+    // Binary search for the first item with a key >= key, so among duplicates of key it returns
+    // the first one. found tells whether that item matches. On a PrefixRecordFormat page the
+    // prefix is checked once and the probes only compare suffixes.
+    int searchKey(const TKey& key, bool* found) {
+        if constexpr (DenseKeys) {
+            auto keys = getKeyArray();
+            auto pos = LowerBound(keys, _header._items_count, key);
+            *found = pos < _header._items_count && keys[pos] == key;
+            return pos;
+        }
+        if constexpr (std::is_same_v<TKey, std::string>) {
+            if (getRecordFormat() == PrefixRecordFormat) {
+                auto prefix = getKeyPrefix();
+                auto head = std::string_view(key).substr(0, prefix.size());
+                if (head != prefix) {
+                    *found = false;
+                    return head < prefix ? 0 : _header._items_count;
                 }
+
+                return searchView(std::string_view(key).substr(prefix.size()), found);
             }
-            
-            return low;
         }
+
+        return searchView(key, found);
     }
-    
-    BTreePagerHeader _header; // 40 bytes
+
+    template <typename TProbe>
+    int searchView(const TProbe& key, bool* found) {
+        int low = 0, high = _header._items_count;
+        while (low < high) {
+            auto mid = (low + high) / 2;
+            if (key > getItemKeyView(mid))
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        *found = low < _header._items_count && !(key < getItemKeyView(low));
+        return low;
+    }
+
+    uint16_t findItemInsertPosition(const TKey& key, bool* append) {
+        bool found = false;
+        uint16_t pos = searchKey(key, &found);
+        *append = pos == _header._items_count;
+        return pos;
+    }
+
+    BTreePagerHeader _header; // 48 bytes
+
+    // Item offsets and records
+    unsigned char _data[MaxPageSlotSpace];
 };
 
+// Intermediate node. Items are (separator key, child PID) records where the child holds keys
+// <= separator, and keys greater than the last separator live in _right_child_pid. The layout
+// only depends on the key type, so trees with different value types share it.
+template <typename TKey>
+class BTreeInternalNode : public BTreePage<TKey> {
+public:
+    static BTreeInternalNode<TKey>* getNode(uint32_t pid) {
+        return reinterpret_cast<BTreeInternalNode<TKey>*>(BufferCacheInstance.get(pid));
+    }
+
+    // PID of the child whose key range covers key
+    uint32_t findChild(const TKey& key) {
+        bool found = false;
+        return getChildPid(this->searchKey(key, &found));
+    }
+
+    // Child PID at index. index == _items_count maps to the rightmost child
+    uint32_t getChildPid(uint16_t index) {
+        if (index >= _header._items_count)
+            return _header._right_child_pid;
+
+        uint32_t pid;
+        std::memcpy(&pid, getChildPidPtr(index), sizeof(uint32_t));
+        return pid;
+    }
+
+    // Append a (separator, child) item after all existing items. Returns false when the item
+    // would take the node over fillFactor.
+    bool append(const TKey& separator, uint32_t childPid, double fillFactor) {
+        auto keySize = this->getKeySize(separator);
+        if (!this->fits(keySize + sizeof(uint32_t), fillFactor))
+            return false;
+
+        auto ptr = allocateSeparator(_header._items_count, separator, keySize + sizeof(uint32_t));
+        std::memcpy(ptr, &childPid, sizeof(uint32_t));
+        SetParentPid(childPid, _header._pid);
+        return true;
+    }
+
+    void setRightChild(uint32_t childPid) {
+        _header._right_child_pid = childPid;
+        SetParentPid(childPid, _header._pid);
+    }
+
+    // Drop the last separator and make its child the rightmost one. Returns the old rightmost
+    // child and the separator, now the largest key of the node.
+    std::pair<uint32_t, TKey> popRightChild() {
+        auto index = _header._items_count - 1;
+        auto rightChild = _header._right_child_pid;
+        auto separator = this->getItemKey(index);
+        _header._right_child_pid = getChildPid(index);
+        this->removeItem(index, this->getKeySize(separator) + sizeof(uint32_t));
+        return std::make_pair(rightChild, separator);
+    }
+
+    void reparentChildren() {
+        for (auto i = 0; i <= _header._items_count; i++)
+            SetParentPid(getChildPid(i), _header._pid);
+    }
+
+    // Move the root's content into a new child and turn the root into an intermediate node whose
+    // only child is the new one, so the root PID never changes. Returns the new child.
+    static BTreePagerHeader* growRoot(BTreePagerHeader* root) {
+        unsigned char* page;
+        auto childPid = BufferCacheInstance.initNextFreePage(&page);
+        CopyPage(page, (unsigned char*)root);
+        auto child = reinterpret_cast<BTreePagerHeader*>(page);
+        child->_pid = childPid;
+        child->_p_pid = root->_pid;
+        SetNodeType(&child->_info, root->_info & (LeafNode | IntermediateNode));
+        if (!IsLeafNode(child->_info))
+            reinterpret_cast<BTreeInternalNode<TKey>*>(page)->reparentChildren();
+
+        InitBTreePage((unsigned char*)root, root->_pid, RootNode | IntermediateNode, InvalidPid);
+        root->_right_child_pid = childPid;
+        return child;
+    }
+
+    // Insert separator into node's parent so that node keeps keys <= separator and sibling
+    // takes over node's old child position. Splits the parent first when it is full.
+    static void insertIntoParent(BTreePagerHeader* node, const TKey& separator, BTreePagerHeader* sibling) {
+        auto parent = getNode(node->_p_pid);
+        auto keySize = parent->getKeySize(separator);
+        if (parent->needSplit(keySize + sizeof(uint32_t))) {
+            parent->split();
+            // the split may have moved node under a new parent
+            parent = getNode(node->_p_pid);
+            keySize = parent->getKeySize(separator);
+        }
+
+        auto pos = parent->findChildPosition(separator, node->_pid);
+        parent->setChildPid(pos, sibling->_pid);
+        auto ptr = parent->allocateSeparator(pos, separator, keySize + sizeof(uint32_t));
+        std::memcpy(ptr, &node->_pid, sizeof(uint32_t));
+        sibling->_p_pid = parent->_header._pid;
+    }
+
+    // Split this node around its median and push the median separator into the parent. A root
+    // node first moves its content into a new child.
+    void split() {
+        if (_header._items_count < 3)
+            throw std::runtime_error("Separator is too large for an empty page");
+
+        auto node = IsRootNode(_header._info) ? reinterpret_cast<BTreeInternalNode<TKey>*>(growRoot(&_header)) : this;
+        auto sibling = reinterpret_cast<BTreeInternalNode<TKey>*>(AllocateBTreePage(IntermediateNode, node->_header._p_pid));
+        // items move as raw bytes, so the sibling keeps the record format
+        sibling->setRecordFormat(node->getRecordFormat());
+        auto separator = node->moveUpperHalf(sibling);
+        LinkRightSibling(&node->_header, &sibling->_header);
+        insertIntoParent(&node->_header, separator, &sibling->_header);
+    }
+
+    // Bytes an item for separator takes
+    size_t getSeparatorSize(const TKey& separator) { return this->getKeySize(separator) + sizeof(uint32_t); }
+
+    // Whether the node takes an item of separatorSize bytes without splitting
+    bool hasRoom(size_t separatorSize) { return !this->needSplit(separatorSize); }
+
+    // Separator split() pushes into the parent
+    TKey getSplitSeparator() {
+        if (_header._items_count < 3)
+            throw std::runtime_error("Separator is too large for an empty page");
+
+        return this->getItemKey(_header._items_count / 2);
+    }
+
+private:
+    template <typename, typename>
+    friend class BTreeNode;
+    using BTreePage<TKey>::_header;
+
+    unsigned char* getChildPidPtr(uint16_t index) { return this->getItemValuePtr(index); }
+
+    size_t getItemSize(uint16_t index) {
+        return this->getItemValuePtr(index) - this->getItemPtr(index) + sizeof(uint32_t);
+    }
+
+    // allocateItem for a separator item of itemSize bytes, compacting the records first when
+    // removed records hold the space it needs
+    unsigned char* allocateSeparator(uint16_t pos, const TKey& separator, size_t itemSize) {
+        if (this->needsCompaction(itemSize))
+            this->compact([this](uint16_t index) { return getItemSize(index); });
+        return this->allocateItem(pos, separator, itemSize);
+    }
+
+    void setChildPid(uint16_t index, uint32_t pid) {
+        if (index >= _header._items_count)
+            _header._right_child_pid = pid;
+        else
+            std::memcpy(getChildPidPtr(index), &pid, sizeof(uint32_t));
+    }
+
+    // Position of the child pid in this node, key is used as a search hint
+    uint16_t findChildPosition(const TKey& key, uint32_t pid) {
+        bool append = false;
+        auto pos = this->findItemInsertPosition(key, &append);
+        if (getChildPid(pos) == pid)
+            return pos;
+
+        // duplicated separators may hide the child from the binary search
+        for (uint16_t i = 0; i <= _header._items_count; i++)
+            if (getChildPid(i) == pid)
+                return i;
+
+        throw std::runtime_error("Child is not found in parent node");
+    }
+
+
+    // Keep the lower half of the items and move the upper half to sibling. The median separator
+    // moves up to the parent and its child becomes the rightmost child of this node.
+    TKey moveUpperHalf(BTreeInternalNode<TKey>* sibling) {
+        alignas(BTreePagerHeader) unsigned char copy[PageSize];
+        std::memcpy(copy, this, PageSize);
+        auto source = reinterpret_cast<BTreeInternalNode<TKey>*>(copy);
+        uint16_t count = _header._items_count;
+        uint16_t median = count / 2;
+        this->resetItems();
+
+        for (uint16_t i = 0; i < median; i++)
+            this->appendItem(source, i, source->getItemSize(i));
+        for (uint16_t i = median + 1; i < count; i++)
+            sibling->appendItem(source, i, source->getItemSize(i));
+
+        sibling->_header._right_child_pid = _header._right_child_pid;
+        _header._right_child_pid = source->getChildPid(median);
+        sibling->reparentChildren();
+        return source->getItemKey(median);
+    }
+
+    // Drop the separator at pos after its child was merged into the next child, which merged
+    // now stands for
+    void removeSeparator(uint16_t pos, uint32_t merged) {
+        this->removeItem(pos, getItemSize(pos));
+        setChildPid(pos, merged);
+    }
+
+    // Replace the separator at pos. Returns false when the node has no room for a longer one.
+    bool replaceSeparator(uint16_t pos, const TKey& separator) {
+        if constexpr (BTreePage<TKey>::DenseKeys) {
+            this->getKeyArray()[pos] = separator;
+            return true;
+        } else {
+            auto size = getSeparatorSize(separator);
+            if (size > getItemSize(pos) && !hasRoom(size))
+                return false;
+
+            auto childPid = getChildPid(pos);
+            this->removeItem(pos, getItemSize(pos));
+            std::memcpy(allocateSeparator(pos, separator, size), &childPid, sizeof(uint32_t));
+            return true;
+        }
+    }
+
+    // Merge right, the child after left whose separator is at pos, into left when their items
+    // fit in one node. The separator moves down between the items of the two. Returns false,
+    // leaving the nodes untouched, when they don't fit.
+    bool mergeChildren(uint16_t pos, BTreeInternalNode<TKey>* left, BTreeInternalNode<TKey>* right) {
+        auto separator = this->getItemKey(pos);
+        auto size = left->getUsedSpace() + right->getUsedSpace() + left->getSeparatorSize(separator) + BTreePage<TKey>::SlotSize;
+        if (size > MaxFillFactor * MaxPageSlotSpace)
+            return false;
+
+        alignas(BTreePagerHeader) unsigned char copy[PageSize];
+        std::memcpy(copy, left, PageSize);
+        auto source = reinterpret_cast<BTreeInternalNode<TKey>*>(copy);
+        left->resetItems();
+        for (uint16_t i = 0; i < source->_header._items_count; i++)
+            left->appendItem(source, i, source->getItemSize(i));
+        left->append(separator, source->_header._right_child_pid, 1.0);
+        for (uint16_t i = 0; i < right->_header._items_count; i++)
+            left->appendItem(right, i, right->getItemSize(i));
+
+        left->_header._right_child_pid = right->_header._right_child_pid;
+        left->reparentChildren();
+        UnlinkRightSibling(&left->_header, &right->_header);
+        removeSeparator(pos, left->_header._pid);
+        return true;
+    }
+};
+
+template <typename TKey, typename TVal>
+class BTreeCursor;
+
+// Leaf node. Items are (key, value) records. The root handle of a tree is also a BTreeNode,
+// insert and find descend through intermediate nodes when it is not a leaf.
+template <typename TKey, typename TVal>
+class BTreeNode : public BTreePage<TKey> {
+public:
+    static BTreeNode<TKey,TVal>* getNode(uint32_t pid) {
+        return reinterpret_cast<BTreeNode<TKey,TVal>*>(BufferCacheInstance.get(pid));
+    }
+
+    // Allocate an empty node from the buffer cache
+    static BTreeNode<TKey,TVal>* newNode(uint16_t type, uint32_t parentPid) {
+        return reinterpret_cast<BTreeNode<TKey,TVal>*>(AllocateBTreePage(type, parentPid));
+    }
+
+    // Insert an item under this root. Safe to run concurrently with inserts and finds on the
+    // same tree: the descent latches nothing, then only the leaf is latched, plus its parent when
+    // the leaf has to split. Intermediate nodes short of room for a separator are split on the
+    // way down, so a split never climbs more than one level. After a split the insert restarts
+    // from the root. Returns the PID of the leaf holding the item.
+    uint32_t insert(const TKey& key, const TVal& value) {
+        // room intermediate nodes on the path must have for a separator, it grows when a split
+        // finds the parent too full for the separator it pushes up
+        size_t separatorSize = 0;
+        while (true) {
+            auto pid = tryInsert(key, value, false, &separatorSize);
+            if (pid != InvalidPid)
+                return pid;
+        }
+    }
+
+    // Replace the value of the item with key under this root, or insert the item when key is not
+    // found. A value that fits the old record is written over it in place, a longer one moves the
+    // record within the page and only splits the leaf when the page has no room for it. Latches
+    // like insert, releasing the leaf bumps its version. Returns the PID of the leaf holding the
+    // item.
+    uint32_t upsert(const TKey& key, const TVal& value) {
+        size_t separatorSize = 0;
+        while (true) {
+            auto pid = tryInsert(key, value, true, &separatorSize);
+            if (pid != InvalidPid)
+                return pid;
+        }
+    }
+
+    // Append an item whose key is larger than all keys of this leaf. Returns false when the item
+    // would take the node over fillFactor. A dense key leaf filled from empty can stage the item
+    // offsets in offsets, see stageItem().
+    bool append(const TKey& key, const TVal& value, double fillFactor, uint16_t* offsets = nullptr) {
+        auto valueSize = getValueSize(value);
+        if (!coverKey(key, valueSize, fillFactor))
+            return false;
+
+        auto keySize = this->getKeySize(key);
+        if (!this->fits(keySize + valueSize, fillFactor))
+            return false;
+
+        if constexpr (BTreePage<TKey>::DenseKeys) {
+            if (offsets != nullptr) {
+                serializeValue(value, this->stageItem(key, valueSize, offsets));
+                return true;
+            }
+        }
+        if (this->needsCompaction(keySize + valueSize))
+            defragment();
+        auto currentPtr = this->allocateItem(_header._items_count, key, keySize + valueSize);
+        serializeValue(value, currentPtr);
+        return true;
+    }
+
+    // Find key under this root without latching, restarting whenever a page changes while it
+    // is being read
+    FindResult<TVal> find(const TKey& key, bool forInsert) {
+        while (true) {
+            FindResult<TVal> result(InvalidPid);
+            if (tryFind(key, forInsert, &result))
+                return result;
+        }
+    }
+
+    // Find keys[i] under this root into results[i] for a whole batch of keys. The probes go down
+    // in key order one level at a time, and the child pages of a level are all prefetched before
+    // any of them is searched, so their cache misses overlap. Probes whose pages change under
+    // them fall back to find.
+    void multiGet(std::span<const TKey> keys, std::span<FindResult<TVal>> results) {
+        if (keys.size() != results.size())
+            throw std::runtime_error("Keys and results differ in size");
+
+        auto count = keys.size();
+        std::vector<uint32_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+        // node and version every probe has reached, in key order. A nullptr node marks a probe
+        // that restarts through find.
+        std::vector<std::pair<BTreePage<TKey>*, uint32_t>> probes(count, std::make_pair(this, this->readVersion()));
+        std::vector<uint32_t> childPids(count);
+        auto descending = !this->isLeaf();
+        while (descending) {
+            // the searches run on the pages prefetched for the previous level
+            for (size_t i = 0; i < count; i++) {
+                auto [node, version] = probes[i];
+                if (node == nullptr || node->isLeaf())
+                    continue;
+
+                auto inner = reinterpret_cast<BTreeInternalNode<TKey>*>(node);
+                auto& key = keys[order[i]];
+                childPids[i] = inner->findChild(key);
+                if (!inner->validate(version)) {
+                    probes[i].first = nullptr;
+                    continue;
+                }
+
+                // neighbouring probes mostly share their child
+                if (i == 0 || childPids[i] != childPids[i - 1])
+                    PrefetchPage(BufferCacheInstance.get(childPids[i]));
+            }
+
+            // the child version is read before the node is validated, as in descendOptimistic
+            descending = false;
+            for (size_t i = 0; i < count; i++) {
+                auto& [node, version] = probes[i];
+                if (node == nullptr || node->isLeaf())
+                    continue;
+
+                auto child = BTreeInternalNode<TKey>::getNode(childPids[i]);
+                auto childVersion = child->readVersion();
+                if (!node->validate(version)) {
+                    node = nullptr;
+                    continue;
+                }
+
+                node = child;
+                version = childVersion;
+                descending |= !child->isLeaf();
+            }
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            auto [node, version] = probes[i];
+            auto& key = keys[order[i]];
+            auto& result = results[order[i]];
+            auto leaf = reinterpret_cast<BTreeNode<TKey,TVal>*>(node);
+            if (node == nullptr || !leaf->findInLeafOptimistic(key, false, version, &result))
+                result = find(key, false);
+        }
+    }
+
+    // Remove one item with key under this root. A leaf left underfull is merged with or
+    // refilled from a sibling, and merges go on up the tree while they leave parents underfull.
+    // Latches like insert, rebalancing stops at nodes other writers hold. Returns false when key
+    // is not found.
+    bool remove(const TKey& key) {
+        while (true) {
+            bool removed = false;
+            if (tryRemove(key, &removed))
+                return removed;
+        }
+    }
+
+    void to_string() {
+        std::string nodeType;
+        if ((_header._info & RootNode) == RootNode)
+            nodeType = "Root";
+        if ((_header._info & IntermediateNode) == IntermediateNode)
+            nodeType = "Intermediate";
+        if ((_header._info & LeafNode) == LeafNode) {
+            if (nodeType.size() > 0)
+                nodeType.append(" Leaf");
+            else
+                nodeType = "Leaf";
+        }
+
+        if (nodeType.size() == 0)
+            throw std::runtime_error("Invalid node type:");
+
+        std::cout<<"=========="<<_header._pid<<"==========="<<std::endl;
+        std::cout<<"Type:"<<nodeType<<std::endl;
+        std::cout<<"Items Count:"<<_header._items_count<<std::endl;
+        std::cout<<"Parent:"<<_header._p_pid<<std::endl;
+        std::cout<<"Left Sibling:"<<_header._l_pid<<std::endl;
+        std::cout<<"Right Sibling:"<<_header._r_pid<<std::endl;
+        std::cout<<"Slot Offset:"<<_header._upper<<std::endl;
+        std::cout<<"Right Child:"<<_header._right_child_pid<<std::endl;
+        std::cout<<"Record Format:"<<(this->getRecordFormat() >> 4)<<std::endl;
+        std::cout<<"Keys:"<<std::endl;
+
+        auto internalNode = reinterpret_cast<BTreeInternalNode<TKey>*>(this);
+        for (auto i = 0; i < _header._items_count; i++) {
+            std::cout<<i<<"  "<<"Key:"<<this->getItemKey(i)<<" ";
+            if (this->isLeaf())
+                std::cout<<"Val:"<<getItemValue(i)<<std::endl;
+            else
+                std::cout<<"Child:"<<internalNode->getChildPid(i)<<std::endl;
+        }
+    }
+    
+    void set_header(const BTreePagerHeader& header) { _header = header; }
+
+private:
+    friend class BTreeCursor<TKey,TVal>;
+    using BTreePage<TKey>::_header;
+
+    // Move from the intermediate node at version to the child covering key. The child version
+    // is read before the node is validated, so the child was not split away in between.
+    // Returns false when the node has changed.
+    static bool descendOptimistic(BTreePage<TKey>** node, uint32_t* version, const TKey& key) {
+        auto inner = reinterpret_cast<BTreeInternalNode<TKey>*>(*node);
+        auto childPid = inner->findChild(key);
+        if (!inner->validate(*version))
+            return false;
+
+        auto child = BTreeInternalNode<TKey>::getNode(childPid);
+        auto childVersion = child->readVersion();
+        if (!inner->validate(*version))
+            return false;
+
+        *node = child;
+        *version = childVersion;
+        return true;
+    }
+
+    // One optimistic descent of find. Returns false when it has to restart.
+    bool tryFind(const TKey& key, bool forInsert, FindResult<TVal>* result) {
+        BTreePage<TKey>* node = this;
+        auto version = node->readVersion();
+        while (!node->isLeaf())
+            if (!descendOptimistic(&node, &version, key))
+                return false;
+
+        return reinterpret_cast<BTreeNode<TKey,TVal>*>(node)->findInLeafOptimistic(key, forInsert, version, result);
+    }
+
+    // One attempt of insert, or of upsert when replace is set. Returns InvalidPid when it has to
+    // restart.
+    uint32_t tryInsert(const TKey& key, const TVal& value, bool replace, size_t* separatorSize) {
+        BTreeInternalNode<TKey>* parent = nullptr;
+        uint32_t parentVersion = 0;
+        BTreePage<TKey>* node = this;
+        auto version = node->readVersion();
+        while (!node->isLeaf()) {
+            auto inner = reinterpret_cast<BTreeInternalNode<TKey>*>(node);
+            if (!inner->hasRoom(std::max(*separatorSize, inner->getSeparatorSize(key)))) {
+                if (inner->tryUpgrade(version))
+                    splitLatched(inner, parent, parentVersion, separatorSize);
+                return InvalidPid;
+            }
+
+            parent = inner;
+            parentVersion = version;
+            if (!descendOptimistic(&node, &version, key))
+                return InvalidPid;
+        }
+
+        auto leaf = reinterpret_cast<BTreeNode<TKey,TVal>*>(node);
+        if (!leaf->tryUpgrade(version))
+            return InvalidPid;
+
+        if (!leaf->insertInLeaf(key, value, replace)) {
+            splitLatched(leaf, parent, parentVersion, separatorSize);
+            return InvalidPid;
+        }
+
+        auto pid = leaf->_header._pid;
+        leaf->writeUnlock();
+        return pid;
+    }
+
+    // Split node, latched by the caller, and release its latch. The parent at parentVersion is
+    // latched to take the separator. When it has no room for it, separatorSize grows so the next
+    // descent splits the parent first.
+    template <typename TNode>
+    static void splitLatched(TNode* node, BTreeInternalNode<TKey>* parent, uint32_t parentVersion, size_t* separatorSize) {
+        bool parentLatched = false;
+        try {
+            if (parent != nullptr) {
+                if (!parent->tryUpgrade(parentVersion)) {
+                    node->writeUnlock();
+                    return;
+                }
+
+                parentLatched = true;
+                auto size = parent->getSeparatorSize(node->getSplitSeparator());
+                if (!parent->hasRoom(size)) {
+                    *separatorSize = std::max(*separatorSize, size);
+                    parent->writeUnlock();
+                    node->writeUnlock();
+                    return;
+                }
+            }
+
+            if constexpr (std::is_same_v<TNode, BTreeNode<TKey,TVal>>) {
+                BTreeNode<TKey,TVal> *left, *right;
+                node->split(&left, &right);
+            } else
+                node->split();
+        } catch (...) {
+            if (parentLatched)
+                parent->writeUnlock();
+            node->writeUnlock();
+            throw;
+        }
+
+        if (parentLatched)
+            parent->writeUnlock();
+        node->writeUnlock();
+    }
+
+    // One attempt of remove. Returns false when it has to restart.
+    bool tryRemove(const TKey& key, bool* removed) {
+        // intermediate nodes from the root down, with the versions they were read at
+        std::pair<BTreeInternalNode<TKey>*, uint32_t> path[MaxTreeHeight];
+        int depth = 0;
+        BTreePage<TKey>* node = this;
+        auto version = node->readVersion();
+        while (!node->isLeaf()) {
+            if (depth == MaxTreeHeight)
+                throw std::runtime_error("Tree is too deep");
+
+            path[depth++] = std::make_pair(reinterpret_cast<BTreeInternalNode<TKey>*>(node), version);
+            if (!descendOptimistic(&node, &version, key))
+                return false;
+        }
+
+        auto leaf = reinterpret_cast<BTreeNode<TKey,TVal>*>(node);
+        if (!leaf->tryUpgrade(version))
+            return false;
+
+        bool found = false;
+        auto index = leaf->searchKey(key, &found);
+        *removed = found;
+        if (!found) {
+            leaf->writeUnlock();
+            return true;
+        }
+
+        FreeOverflowPages(leaf->getOverflowPid(index));
+        leaf->removeItem(index, leaf->getItemSize(index));
+        rebalance(leaf, key, path, depth);
+        return true;
+    }
+
+    // Merge node, latched by the caller and reached through path, with its right sibling under
+    // the same parent, or its left one when it is the last child, while it is underfull. When
+    // the two don't fit in one node, leaves even out their items instead. A merge takes a
+    // separator out of the parent, which is rebalanced next, and a root left with a single child
+    // takes over the child's content. Releases all latches.
+    static void rebalance(BTreePage<TKey>* node, const TKey& key, std::pair<BTreeInternalNode<TKey>*, uint32_t>* path, int depth) {
+        while (depth > 0 && node->isUnderfull()) {
+            auto [parent, parentVersion] = path[--depth];
+            if (!parent->tryUpgrade(parentVersion))
+                break;
+
+            if (parent->_header._items_count == 0) {
+                parent->writeUnlock();
+                break;
+            }
+
+            auto pos = parent->findChildPosition(key, node->getHeader()->_pid);
+            auto leftPos = pos < parent->_header._items_count ? pos : pos - 1;
+            BTreePage<TKey>* left = BTreeInternalNode<TKey>::getNode(parent->getChildPid(leftPos));
+            BTreePage<TKey>* right = BTreeInternalNode<TKey>::getNode(parent->getChildPid(leftPos + 1));
+            if (!(left == node ? right : left)->tryWriteLock()) {
+                parent->writeUnlock();
+                break;
+            }
+
+            bool merged;
+            if (node->isLeaf())
+                merged = rebalanceLeaves(parent, leftPos, reinterpret_cast<BTreeNode<TKey,TVal>*>(left), reinterpret_cast<BTreeNode<TKey,TVal>*>(right));
+            else
+                merged = parent->mergeChildren(leftPos, reinterpret_cast<BTreeInternalNode<TKey>*>(left), reinterpret_cast<BTreeInternalNode<TKey>*>(right));
+
+            auto rightPid = right->getHeader()->_pid;
+            left->writeUnlock();
+            right->writeUnlock();
+            if (!merged) {
+                parent->writeUnlock();
+                return;
+            }
+
+            // the version bump above makes readers still holding the page restart
+            BufferCacheInstance.free(rightPid);
+            node = parent;
+        }
+
+        if (IsRootNode(node->getHeader()->_info) && !node->isLeaf() && node->getHeader()->_items_count == 0)
+            collapseRoot(reinterpret_cast<BTreeInternalNode<TKey>*>(node));
+        node->writeUnlock();
+    }
+
+    // Move the only child of the latched root into the root page, keeping the root PID
+    static void collapseRoot(BTreeInternalNode<TKey>* root) {
+        auto child = BTreeInternalNode<TKey>::getNode(root->_header._right_child_pid);
+        if (!child->tryWriteLock())
+            return;
+
+        auto rootPid = root->_header._pid;
+        auto childPid = child->_header._pid;
+        CopyPage((unsigned char*)root, (unsigned char*)child);
+        root->_header._pid = rootPid;
+        root->_header._p_pid = InvalidPid;
+        SetNodeType(&root->_header._info, RootNode | (child->_header._info & (LeafNode | IntermediateNode)));
+        if (!root->isLeaf())
+            root->reparentChildren();
+        child->writeUnlock();
+        BufferCacheInstance.free(childPid);
+    }
+
+    // Move the items of right, the leaf after left whose separator is at pos in parent, into
+    // left when they fit in one node, otherwise split the items evenly between the two. Returns
+    // true when right was merged into left. Nothing changes when the parent has no room for
+    // the new separator.
+    static bool rebalanceLeaves(BTreeInternalNode<TKey>* parent, uint16_t pos, BTreeNode<TKey,TVal>* left, BTreeNode<TKey,TVal>* right) {
+        alignas(BTreePagerHeader) unsigned char leftCopy[PageSize];
+        alignas(BTreePagerHeader) unsigned char rightCopy[PageSize];
+        std::memcpy(leftCopy, left, PageSize);
+        std::memcpy(rightCopy, right, PageSize);
+        auto leftSource = reinterpret_cast<BTreeNode<TKey,TVal>*>(leftCopy);
+        auto rightSource = reinterpret_cast<BTreeNode<TKey,TVal>*>(rightCopy);
+        uint16_t leftCount = leftSource->_header._items_count;
+        uint16_t count = leftCount + rightSource->_header._items_count;
+        auto sourceOf = [&](uint16_t i) { return i < leftCount ? leftSource : rightSource; };
+        auto indexOf = [&](uint16_t i) -> uint16_t { return i < leftCount ? i : i - leftCount; };
+
+        // longest prefix shared by the items from first to last of a PrefixRecordFormat leaf
+        auto isPrefixFormat = left->getRecordFormat() == PrefixRecordFormat;
+        auto commonPrefix = [&](uint16_t first, uint16_t last) {
+            std::string prefix;
+            if constexpr (std::is_same_v<TKey, std::string>) {
+                if (isPrefixFormat && first <= last && last < count) {
+                    prefix = sourceOf(first)->getItemKey(indexOf(first));
+                    prefix.resize(getCommonPrefixLength(prefix, sourceOf(last)->getItemKey(indexOf(last))));
+                }
+            }
+            return prefix;
+        };
+
+        // items are sized against the prefix shared by all of them, halves only get longer ones
+        auto prefix = commonPrefix(0, count - 1);
+        auto prefixArea = isPrefixFormat ? prefix.size() + sizeof(uint16_t) : 0;
+        std::vector<size_t> sizes(count);
+        size_t total = prefixArea;
+        for (uint16_t i = 0; i < count; i++) {
+            sizes[i] = getCopiedItemSize(sourceOf(i), indexOf(i), prefix.size()) + BTreePage<TKey>::SlotSize;
+            total += sizes[i];
+        }
+
+        if (total <= MaxFillFactor * MaxPageSlotSpace) {
+            left->resetItems(prefix);
+            for (uint16_t i = 0; i < count; i++)
+                left->copyItem(sourceOf(i), indexOf(i));
+            UnlinkRightSibling(&left->_header, &right->_header);
+            parent->removeSeparator(pos, left->_header._pid);
+            return true;
+        }
+
+        uint16_t median = 1;
+        auto leftSize = prefixArea + sizes[0];
+        while (median < count - 1 && leftSize + sizes[median] <= total / 2)
+            leftSize += sizes[median++];
+        if (leftSize > MaxPageSlotSpace || total - leftSize + prefixArea > MaxPageSlotSpace)
+            return false;
+        if (!parent->replaceSeparator(pos, sourceOf(median - 1)->getItemKey(indexOf(median - 1))))
+            return false;
+
+        left->resetItems(commonPrefix(0, median - 1));
+        for (uint16_t i = 0; i < median; i++)
+            left->copyItem(sourceOf(i), indexOf(i));
+        right->resetItems(commonPrefix(median, count - 1));
+        for (uint16_t i = median; i < count; i++)
+            right->copyItem(sourceOf(i), indexOf(i));
+        return false;
+    }
+
+    // Insert into this leaf, or replace the value of an item with key when replace is set.
+    // Returns false when the leaf has to split first.
+    bool insertInLeaf(const TKey& key, const TVal& value, bool replace) {
+        if (replace) {
+            bool found = false;
+            auto index = this->searchKey(key, &found);
+            if (found)
+                return updateInLeaf(index, value);
+        }
+
+        auto valueSize = getValueSize(value);
+        if (!coverKey(key, valueSize, MaxFillFactor) || this->needSplit(this->getKeySize(key) + valueSize))
+            return false;
+
+        // reuse the space of removed records rather than split
+        auto itemSize = this->getKeySize(key) + valueSize;
+        if (this->needsCompaction(itemSize))
+            defragment();
+
+        // insert into the item offset array by using binary search to find the position.
+        bool append = false;
+        auto pos = this->findItemInsertPosition(key, &append);
+        auto currentPtr = this->allocateItem(pos, key, itemSize);
+        serializeValue(value, currentPtr);
+        return true;
+    }
+
+    // Replace the value of the item at index. A value no longer than the old one is serialized
+    // over it and the bytes it is shorter by count as free space. A longer one moves the record
+    // below _upper and the slot keeps its position. The overflow pages of the old value are
+    // freed. Returns false when the page has no room for the moved record.
+    bool updateInLeaf(uint16_t index, const TVal& value) {
+        size_t keySize = this->getItemValuePtr(index) - this->getItemPtr(index);
+        auto itemSize = getItemSize(index);
+        auto oldValueSize = itemSize - keySize;
+        auto overflowPid = getOverflowPid(index);
+        auto valueSize = getValueSize(value);
+        if (valueSize <= oldValueSize) {
+            serializeValue(value, this->getItemValuePtr(index));
+            _header._free_space += oldValueSize - valueSize;
+            FreeOverflowPages(overflowPid);
+            return true;
+        }
+
+        // the old record still counts, so the page never goes over MaxFillFactor in between
+        auto newSize = keySize + valueSize;
+        if (this->getUsedSpace() + newSize > MaxFillFactor * MaxPageSlotSpace)
+            return false;
+        if (newSize > this->getGapSize())
+            defragment();
+
+        _header._upper -= newSize;
+        auto ptr = (unsigned char*)this + _header._upper;
+        std::memcpy(ptr, this->getItemPtr(index), keySize);
+        serializeValue(value, ptr + keySize);
+        this->getOffsetArray()[index] = _header._upper;
+        _header._free_space += itemSize;
+        FreeOverflowPages(overflowPid);
+        return true;
+    }
+
+    FindResult<TVal> findInLeaf(const TKey& key, bool forInsert) {
+        if (forInsert)
+            return FindResult<TVal>(_header._pid);
+
+        bool found = false;
+        auto index = this->searchKey(key, &found);
+        if (!found)
+            return FindResult<TVal>(InvalidPid);
+
+        // only a hit materializes the value
+        return FindResult<TVal>(_header._pid, getItemValue(index));
+    }
+
+    // findInLeaf for a reader that read this leaf at version without latching it. The leaf is
+    // searched in place, and a value in overflow pages is only read once the leaf is validated,
+    // so a torn length or PID is never followed. Returns false when the leaf has changed.
+    bool findInLeafOptimistic(const TKey& key, bool forInsert, uint32_t version, FindResult<TVal>* result) {
+        *result = FindResult<TVal>(forInsert ? _header._pid : InvalidPid);
+        bool found = false;
+        auto index = forInsert ? 0 : this->searchKey(key, &found);
+        if (!found)
+            return this->validate(version);
+
+        TVal value{};
+        size_t length;
+        auto overflowPid = readInlineValue(index, &value, &length);
+        auto pid = _header._pid;
+        if (!this->validate(version))
+            return false;
+
+        if constexpr (std::is_same_v<TVal, std::string>) {
+            // the item must still be there while its overflow pages are read
+            if (overflowPid != InvalidPid) {
+                *result = FindResult<TVal>(pid, ReadOverflowPages(overflowPid, length));
+                return this->validate(version);
+            }
+        }
+
+        *result = FindResult<TVal>(pid, std::move(value));
+        return true;
+    }
+
+    TVal getItemValue(uint16_t index) {
+        TVal value{};
+        size_t length;
+        auto overflowPid = readInlineValue(index, &value, &length);
+        if constexpr (std::is_same_v<TVal, std::string>) {
+            if (overflowPid != InvalidPid)
+                return ReadOverflowPages(overflowPid, length);
+        }
+
+        return value;
+    }
+
+    // Read the value at index into value unless it is kept in overflow pages. Then it returns
+    // the first overflow PID and sets length, otherwise InvalidPid. Reads stop at the page end.
+    uint32_t readInlineValue(uint16_t index, TVal* value, size_t* length) {
+        auto ptr = this->getItemValuePtr(index);
+        auto end = this->getPageEnd();
+        auto format = this->getRecordFormat();
+        if constexpr (std::is_same_v<TVal, std::string>) {
+            auto prefixSize = readStringLength(ptr, end, length, format);
+            if (*length > MaxInlineValueLength) {
+                uint32_t pid = InvalidPid;
+                if (ptr + prefixSize + sizeof(uint32_t) <= end)
+                    std::memcpy(&pid, ptr + prefixSize, sizeof(uint32_t));
+                return pid;
+            }
+        }
+
+        *value = deserialize<TVal>(ptr, end, format);
+        return InvalidPid;
+    }
+
+    // Serialized length of the record at index, key included unless it lives in the key array
+    size_t getItemSize(uint16_t index) {
+        auto ptr = this->getItemValuePtr(index);
+        auto format = this->getRecordFormat();
+        if constexpr (std::is_same_v<TVal, std::string>) {
+            size_t length;
+            auto prefixSize = readStringLength(ptr, &length, format);
+            if (length > MaxInlineValueLength)
+                return ptr - this->getItemPtr(index) + prefixSize + sizeof(uint32_t);
+        }
+
+        if constexpr (IsFixedSize<TVal>)
+            return ptr - this->getItemPtr(index) + BTreeCodec<TVal>::FixedSize;
+        else
+            return ptr - this->getItemPtr(index) + getSerializedSize(deserializeView<TVal>(ptr, format), format);
+    }
+
+    // First overflow page of the value at index, InvalidPid when the value is in the record
+    uint32_t getOverflowPid(uint16_t index) {
+        uint32_t pid = InvalidPid;
+        if constexpr (std::is_same_v<TVal, std::string>) {
+            auto ptr = this->getItemValuePtr(index);
+            size_t length;
+            auto prefixSize = readStringLength(ptr, &length, this->getRecordFormat());
+            if (length > MaxInlineValueLength)
+                std::memcpy(&pid, ptr + prefixSize, sizeof(uint32_t));
+        }
+
+        return pid;
+    }
+
+    // Bytes the value takes in a record, only the length and a PID for an overflow value
+    size_t getValueSize(const TVal& value) {
+        auto size = getSerializedSize(value, this->getRecordFormat());
+        if constexpr (std::is_same_v<TVal, std::string>) {
+            if (value.size() > MaxInlineValueLength)
+                return size - value.size() + sizeof(uint32_t);
+        }
+
+        return size;
+    }
+
+    // Serialize value into a record, a long string goes to new overflow pages
+    void serializeValue(const TVal& value, unsigned char* addr) {
+        auto format = this->getRecordFormat();
+        if constexpr (std::is_same_v<TVal, std::string>) {
+            if (value.size() > MaxInlineValueLength) {
+                auto pid = WriteOverflowPages(value.data(), value.size());
+                addr += writeStringLength(value.size(), addr, format);
+                std::memcpy(addr, &pid, sizeof(uint32_t));
+                return;
+            }
+        }
+
+        serialize(value, addr, format);
+    }
+
+    void defragment() {
+        this->compact([this](uint16_t index) { return getItemSize(index); });
+    }
+
+    // Make the prefix of a PrefixRecordFormat page cover key. An empty page takes the whole key as
+    // its prefix, otherwise the prefix shrinks to what it shares with key and every stored suffix
+    // grows by the bytes dropped from the prefix. Returns false, leaving the page untouched, when
+    // the grown items plus the new item would take the page over fillFactor.
+    bool coverKey(const TKey& key, size_t valueSize, double fillFactor) {
+        if constexpr (std::is_same_v<TKey, std::string>) {
+            if (this->getRecordFormat() != PrefixRecordFormat)
+                return true;
+
+            if (_header._items_count == 0) {
+                this->resetItems(key);
+                return true;
+            }
+
+            if (this->coversKey(key))
+                return true;
+
+            auto prefix = this->getKeyPrefix();
+            auto length = getCommonPrefixLength(prefix, key);
+            auto grow = prefix.size() - length;
+            size_t growth = 0;
+            for (uint16_t i = 0; i < _header._items_count; i++) {
+                auto suffixSize = this->getItemKeyView(i).size();
+                growth += grow + getVarintSize(suffixSize + grow) - getVarintSize(suffixSize);
+            }
+
+            // the prefix area shrinks by the bytes moved into the suffixes
+            auto itemSize = getSerializedSize(std::string_view(key).substr(length), PrefixRecordFormat) + valueSize;
+            if (!this->fits(growth - grow + itemSize, fillFactor))
+                return false;
+
+            alignas(BTreePagerHeader) unsigned char copy[PageSize];
+            std::memcpy(copy, this, PageSize);
+            auto source = reinterpret_cast<BTreeNode<TKey,TVal>*>(copy);
+            this->resetItems(source->getKeyPrefix().substr(0, length));
+            for (uint16_t i = 0; i < source->_header._items_count; i++)
+                copyItem(source, i);
+        }
+
+        return true;
+    }
+
+    // Copy the item at index of source to the end of this node. Between PrefixRecordFormat pages
+    // with different prefixes the key suffix is re-encoded against this page's prefix.
+    void copyItem(BTreeNode<TKey,TVal>* source, uint16_t index) {
+        auto itemSize = source->getItemSize(index);
+        if constexpr (std::is_same_v<TKey, std::string>) {
+            auto sourcePrefix = source->getKeyPrefix();
+            auto prefix = this->getKeyPrefix();
+            if (this->getRecordFormat() == PrefixRecordFormat && sourcePrefix.size() != prefix.size()) {
+                // the full key is sourcePrefix + suffix, the new suffix starts after prefix
+                auto suffix = source->getItemKeyView(index);
+                auto valueSize = itemSize - getSerializedSize(suffix, PrefixRecordFormat);
+                auto head = prefix.size() < sourcePrefix.size() ? sourcePrefix.substr(prefix.size()) : std::string_view();
+                auto tail = suffix.substr(prefix.size() > sourcePrefix.size() ? prefix.size() - sourcePrefix.size() : 0);
+                auto length = head.size() + tail.size();
+                auto ptr = this->allocateSlot(_header._items_count, getVarintSize(length) + length + valueSize);
+                ptr += writeVarint(length, ptr);
+                if (head.size() > 0)
+                    std::memcpy(ptr, head.data(), head.size());
+                if (tail.size() > 0)
+                    std::memcpy(ptr + head.size(), tail.data(), tail.size());
+                std::memcpy(ptr + length, suffix.data() + suffix.size(), valueSize);
+                return;
+            }
+        }
+
+        this->appendItem(source, index, itemSize);
+    }
+
+    // Size the item at index of source takes once copyItem moved it to a page with a prefix of
+    // prefixSize bytes
+    static size_t getCopiedItemSize(BTreeNode<TKey,TVal>* source, uint16_t index, size_t prefixSize) {
+        auto itemSize = source->getItemSize(index);
+        if constexpr (std::is_same_v<TKey, std::string>) {
+            auto sourcePrefixSize = source->getKeyPrefix().size();
+            if (source->getRecordFormat() == PrefixRecordFormat && sourcePrefixSize != prefixSize) {
+                auto suffix = source->getItemKeyView(index);
+                auto length = suffix.size() + sourcePrefixSize - prefixSize;
+                return itemSize - getSerializedSize(suffix, PrefixRecordFormat) + getVarintSize(length) + length;
+            }
+        }
+
+        return itemSize;
+    }
+
+    // Longest prefix shared by the keys from first to last of a PrefixRecordFormat page
+    std::string getCommonKeyPrefix(uint16_t first, uint16_t last) {
+        if constexpr (std::is_same_v<TKey, std::string>) {
+            if (this->getRecordFormat() == PrefixRecordFormat) {
+                auto firstKey = this->getItemKey(first);
+                return firstKey.substr(0, getCommonPrefixLength(firstKey, this->getItemKey(last)));
+            }
+        }
+
+        return std::string();
+    }
+
+    // Separator split() pushes into the parent
+    TKey getSplitSeparator() {
+        if (_header._items_count < 2)
+            throw std::runtime_error("Item is too large for an empty page");
+
+        return this->getItemKey(_header._items_count / 2 - 1);
+    }
+
+    // Split this leaf around its median and push the separator into the parent. A root leaf
+    // first moves its content into a new child. Keys <= the returned separator live in *left,
+    // the rest in *right.
+    TKey split(BTreeNode<TKey,TVal>** left, BTreeNode<TKey,TVal>** right) {
+        if (_header._items_count < 2)
+            throw std::runtime_error("Item is too large for an empty page");
+
+        auto node = IsRootNode(_header._info) ? reinterpret_cast<BTreeNode<TKey,TVal>*>(BTreeInternalNode<TKey>::growRoot(&_header)) : this;
+        auto sibling = newNode(LeafNode, node->_header._p_pid);
+        // items move as raw bytes, so the sibling keeps the record format
+        sibling->setRecordFormat(node->getRecordFormat());
+        auto separator = node->moveUpperHalf(sibling);
+        LinkRightSibling(&node->_header, &sibling->_header);
+        BTreeInternalNode<TKey>::insertIntoParent(&node->_header, separator, &sibling->_header);
+        *left = node;
+        *right = sibling;
+        return separator;
+    }
+
+    // Keep the lower half of the items and move the upper half to sibling. Returns the largest
+    // key left in this node as the separator.
+    TKey moveUpperHalf(BTreeNode<TKey,TVal>* sibling) {
+        alignas(BTreePagerHeader) unsigned char copy[PageSize];
+        std::memcpy(copy, this, PageSize);
+        auto source = reinterpret_cast<BTreeNode<TKey,TVal>*>(copy);
+        uint16_t count = _header._items_count;
+        uint16_t median = count / 2;
+        // each half gets the longer prefix shared by its own keys
+        this->resetItems(source->getCommonKeyPrefix(0, median - 1));
+        sibling->resetItems(source->getCommonKeyPrefix(median, count - 1));
+
+        for (uint16_t i = 0; i < median; i++)
+            this->copyItem(source, i);
+        for (uint16_t i = median; i < count; i++)
+            sibling->copyItem(source, i);
+
+        return source->getItemKey(median - 1);
+    }
+};
+
+
+// Cursor over the items of a tree in key order. After positioning through the root it only
+// walks the leaf sibling chain. A cursor is invalidated by any modification of the tree, it
+// doesn't take part in optimistic latching. It keeps the PID of its leaf, each call pins the
+// leaf only while it runs. Once it moves right over ScanDetectHops leaves in a row it reads
+// the next leaves ahead through their parents, and its pages go to the scan ring of the cache.
+template <typename TKey, typename TVal>
+class BTreeCursor {
+public:
+    explicit BTreeCursor(uint32_t rootPid) : _root_pid(rootPid), _leaf_pid(InvalidPid), _index(0) {}
+
+    // Position at the first item with a key >= key. insert keeps duplicates of a key, the
+    // descent and the leaf search both take the first of them and a run that starts at the end
+    // of the leaf continues in its right siblings.
+    bool seek(const TKey& key) {
+        BufferCache::Scope scope(BufferCacheInstance, false);
+        resetScan();
+        auto root = BTreeNode<TKey,TVal>::getNode(_root_pid);
+        auto leaf = BTreeNode<TKey,TVal>::getNode(root->find(key, true).pid);
+        bool found = false;
+        _index = leaf->searchKey(key, &found);
+        return skipForward(leaf);
+    }
+
+    bool seekFirst() {
+        BufferCache::Scope scope(BufferCacheInstance, false);
+        resetScan();
+        _index = 0;
+        return skipForward(descend(false));
+    }
+
+    bool seekLast() {
+        BufferCache::Scope scope(BufferCacheInstance, false);
+        resetScan();
+        auto leaf = descend(true);
+        _index = leaf->_header._items_count - 1;
+        return skipBackward(leaf);
+    }
+
+    bool next() {
+        BufferCache::Scope scope(BufferCacheInstance, false, isScanning());
+        _index++;
+        return skipForward(BTreeNode<TKey,TVal>::getNode(_leaf_pid));
+    }
+
+    bool prev() {
+        BufferCache::Scope scope(BufferCacheInstance, false);
+        _index--;
+        return skipBackward(BTreeNode<TKey,TVal>::getNode(_leaf_pid));
+    }
+
+    bool isValid() { return _leaf_pid != InvalidPid; }
+
+    const TKey key() {
+        BufferCache::Scope scope(BufferCacheInstance, false, isScanning());
+        return BTreeNode<TKey,TVal>::getNode(_leaf_pid)->getItemKey(_index);
+    }
+
+    TVal value() {
+        BufferCache::Scope scope(BufferCacheInstance, false, isScanning());
+        return BTreeNode<TKey,TVal>::getNode(_leaf_pid)->getItemValue(_index);
+    }
+
+private:
+    BTreeNode<TKey,TVal>* descend(bool rightmost) {
+        auto node = BTreeInternalNode<TKey>::getNode(_root_pid);
+        while (!node->isLeaf())
+            node = BTreeInternalNode<TKey>::getNode(node->getChildPid(rightmost ? node->getHeader()->_items_count : 0));
+
+        return reinterpret_cast<BTreeNode<TKey,TVal>*>(node);
+    }
+
+    // Move from leaf to the right siblings until _index points to an item
+    bool skipForward(BTreeNode<TKey,TVal>* leaf) {
+        while (leaf != nullptr && _index >= leaf->_header._items_count) {
+            auto pid = leaf->_header._r_pid;
+            if (isScanning() && _ahead <= ReadAheadLeaves / 2)
+                readAhead(leaf);
+            leaf = pid == InvalidPid ? nullptr : BTreeNode<TKey,TVal>::getNode(pid);
+            _index = 0;
+            _hops++;
+            if (_ahead > 0)
+                _ahead--;
+        }
+
+        _leaf_pid = leaf == nullptr ? InvalidPid : leaf->_header._pid;
+        return leaf != nullptr;
+    }
+
+    bool isScanning() { return _hops >= ScanDetectHops; }
+
+    void resetScan() {
+        _hops = 0;
+        _ahead = 0;
+    }
+
+    // Start reading the leaves after the last one read ahead, or after leaf when none is. The
+    // leaves are the following children of the parent and of the parent's right siblings.
+    void readAhead(BTreeNode<TKey,TVal>* leaf) {
+        if (_ahead == 0) {
+            _ahead_parent_pid = leaf->_header._p_pid;
+            if (IsRootNode(leaf->_header._info) || _ahead_parent_pid == InvalidPid)
+                return;
+            auto parent = BTreeInternalNode<TKey>::getNode(_ahead_parent_pid);
+            _ahead_index = 0;
+            while (_ahead_index < parent->getHeader()->_items_count && parent->getChildPid(_ahead_index) != leaf->_header._pid)
+                _ahead_index++;
+        }
+
+        std::vector<uint32_t> pids;
+        while (pids.size() < (size_t)ReadAheadLeaves && _ahead_parent_pid != InvalidPid) {
+            auto parent = BTreeInternalNode<TKey>::getNode(_ahead_parent_pid);
+            int count = parent->getHeader()->_items_count;
+            while (pids.size() < (size_t)ReadAheadLeaves && _ahead_index < count)
+                pids.push_back(parent->getChildPid(++_ahead_index));
+            if (_ahead_index >= count) {
+                _ahead_parent_pid = parent->getHeader()->_r_pid;
+                _ahead_index = -1;
+            }
+        }
+        _ahead += (int)pids.size();
+        BufferCacheInstance.readAhead(pids);
+    }
+
+    // Move from leaf to the left siblings until _index points to an item
+    bool skipBackward(BTreeNode<TKey,TVal>* leaf) {
+        resetScan();
+        while (leaf != nullptr && _index < 0) {
+            auto pid = leaf->_header._l_pid;
+            leaf = pid == InvalidPid ? nullptr : BTreeNode<TKey,TVal>::getNode(pid);
+            _index = leaf == nullptr ? 0 : leaf->_header._items_count - 1;
+        }
+
+        _leaf_pid = leaf == nullptr ? InvalidPid : leaf->_header._pid;
+        return leaf != nullptr;
+    }
+
+    uint32_t _root_pid;
+    uint32_t _leaf_pid;
+    int _index;
+    // Leaves moved to the right in a row, and leaves read ahead the cursor didn't reach yet
+    int _hops = 0;
+    int _ahead = 0;
+    // Parent of the last leaf read ahead and its position there
+    uint32_t _ahead_parent_pid = InvalidPid;
+    int _ahead_index = 0;
+};
+
+// A B-tree identified by its root PID, which never changes as the tree grows. Every operation
+// runs in a BufferCache::Scope, so the pages it holds stay cached until it returns. The
+// BTreeNode operations need a Scope of the caller on a file backed cache.
+template <typename TKey, typename TVal>
+class BTree {
+public:
+    BTree() {
+        BufferCache::Scope scope(BufferCacheInstance, true);
+        _root_pid = BTreeNode<TKey,TVal>::newNode(RootNode | LeafNode, InvalidPid)->getHeader()->_pid;
+    }
+
+    explicit BTree(uint32_t rootPid) : _root_pid(rootPid) {}
+
+    uint32_t getRootPid() { return _root_pid; }
+
+    uint32_t insert(const TKey& key, const TVal& value) {
+        BufferCache::Scope scope(BufferCacheInstance, true);
+        return getRoot()->insert(key, value);
+    }
+
+    uint32_t upsert(const TKey& key, const TVal& value) {
+        BufferCache::Scope scope(BufferCacheInstance, true);
+        return getRoot()->upsert(key, value);
+    }
+
+    FindResult<TVal> find(const TKey& key) {
+        BufferCache::Scope scope(BufferCacheInstance, false);
+        return getRoot()->find(key, false);
+    }
+
+    // Find key like find, but suspend on pages that are not cached instead of blocking the
+    // thread. The path is fetched a level at a time and stays pinned, so the lookup itself then
+    // runs on cached pages. Values in overflow pages are still read with blocking I/O.
+    Task<FindResult<TVal>> findAsync(TKey key) {
+        std::vector<BufferCache::PagePin> path;
+        auto pid = _root_pid;
+        while (true) {
+            path.push_back(co_await BufferCacheInstance.fetch(pid));
+            auto node = BTreeInternalNode<TKey>::getNode(pid);
+            if (node->isLeaf())
+                break;
+
+            auto version = node->readVersion();
+            auto childPid = node->findChild(key);
+            if (node->validate(version))
+                pid = childPid;
+            else
+                path.pop_back();
+        }
+
+        BufferCache::Scope scope(BufferCacheInstance, false);
+        co_return getRoot()->find(key, false);
+    }
+
+    // Find keys[i] into results[i], see BTreeNode::multiGet. The pages of the whole batch stay
+    // pinned until it returns.
+    void multiGet(std::span<const TKey> keys, std::span<FindResult<TVal>> results) {
+        BufferCache::Scope scope(BufferCacheInstance, false);
+        getRoot()->multiGet(keys, results);
+    }
+
+    bool remove(const TKey& key) {
+        BufferCache::Scope scope(BufferCacheInstance, true);
+        return getRoot()->remove(key);
+    }
+
+    BTreeCursor<TKey,TVal> cursor() { return BTreeCursor<TKey,TVal>(_root_pid); }
+
+    // Record format of the leaves of an empty tree, split leaves inherit it
+    void setRecordFormat(uint16_t format) {
+        BufferCache::Scope scope(BufferCacheInstance, true);
+        auto root = getRoot();
+        root->writeLock();
+        try {
+            root->setRecordFormat(format);
+        } catch (...) {
+            root->writeUnlock();
+            throw;
+        }
+        root->writeUnlock();
+    }
+
+    // Call callback(key, value) for every item with lo <= key <= hi in key order, until the
+    // callback returns false. Returns the number of items visited.
+    template <typename TCallback>
+    uint64_t scan(const TKey& lo, const TKey& hi, TCallback&& callback) {
+        uint64_t count = 0;
+        auto it = cursor();
+        for (auto valid = it.seek(lo); valid; valid = it.next()) {
+            auto key = it.key();
+            if (key > hi)
+                break;
+
+            count++;
+            if (!callback(key, it.value()))
+                break;
+        }
+
+        return count;
+    }
+
+    // Build the tree bottom-up from items sorted by strictly ascending key, such as the content
+    // of a std::map. Leaves are filled sequentially up to fillFactor, then each intermediate level
+    // is built from the separators of the level below. The tree must be empty.
+    // Returns the number of pages in the tree.
+    template <typename TIterator>
+    uint32_t bulkLoad(TIterator begin, TIterator end, double fillFactor = MaxFillFactor) {
+        if (fillFactor <= 0 || fillFactor > 1.0)
+            throw std::runtime_error("Fill factor must be in (0, 1]");
+
+        uint16_t format;
+        {
+            BufferCache::Scope scope(BufferCacheInstance, false);
+            if (getRoot()->getHeader()->_items_count > 0 || !getRoot()->isLeaf())
+                throw std::runtime_error("Bulk load requires an empty tree");
+            format = getRoot()->getRecordFormat();
+        }
+        if (begin == end)
+            return 1;
+
+        // (largest key, pid) of every node in the level being built. Each node is filled in a
+        // Scope of its own, so only the pages being filled stay pinned. A new page is logged
+        // whole when its Scope ends and needs no latch, pages logged before are latched while
+        // they change so a durable cache logs the changes. No other thread reaches the new pages
+        // before the root links to them, so a cache that doesn't log leaves them unlatched.
+        auto durable = BufferCacheInstance.isDurable();
+        auto latch = [durable](auto page) {
+            if (durable)
+                page->writeLock();
+        };
+        auto unlatch = [durable](auto page) {
+            if (durable)
+                page->writeUnlock();
+        };
+        std::vector<std::pair<TKey, uint32_t>> level;
+        uint32_t pages = 0;
+        // item offsets of the dense key leaf being filled, see stageItem()
+        uint16_t offsets[MaxPageSlotSpace / sizeof(uint16_t)];
+        for (auto it = begin; it != end;) {
+            BufferCache::Scope scope(BufferCacheInstance, true);
+            if (!level.empty() && !(it->first > level.back().first))
+                throw std::runtime_error("Bulk load input is not sorted by ascending unique keys");
+            auto leaf = BTreeNode<TKey,TVal>::newNode(LeafNode, InvalidPid);
+            leaf->setRecordFormat(format);
+            if (!leaf->append(it->first, it->second, fillFactor, offsets))
+                throw std::runtime_error("Item is too large for an empty page");
+
+            auto last = it;
+            for (++it; it != end; last = it, ++it) {
+                if (!(it->first > last->first))
+                    throw std::runtime_error("Bulk load input is not sorted by ascending unique keys");
+                if (!leaf->append(it->first, it->second, fillFactor, offsets))
+                    break;
+            }
+            if constexpr (BTreePage<TKey>::DenseKeys)
+                leaf->placeOffsets(offsets);
+
+            auto leafPid = leaf->getHeader()->_pid;
+            if (!level.empty()) {
+                auto previous = BTreeNode<TKey,TVal>::getNode(level.back().second);
+                latch(previous);
+                LinkRightSibling(previous->getHeader(), leaf->getHeader());
+                unlatch(previous);
+            }
+            level.emplace_back(last->first, leafPid);
+            pages++;
+        }
+
+        while (level.size() > 1) {
+            std::vector<std::pair<TKey, uint32_t>> parents;
+            for (size_t i = 0; i < level.size();) {
+                BufferCache::Scope scope(BufferCacheInstance, true);
+                auto parent = reinterpret_cast<BTreeInternalNode<TKey>*>(AllocateBTreePage(IntermediateNode, InvalidPid));
+                auto parentPid = parent->getHeader()->_pid;
+                pages++;
+                // reparenting latches the children, which logs the new pages of the Scope early
+                latch(parent);
+                if (i + 1 == level.size() && !parents.empty()) {
+                    // a parent of the last child alone would have no separator, the previous
+                    // parent hands its rightmost child over
+                    auto previous = BTreeInternalNode<TKey>::getNode(parents.back().second);
+                    latch(previous);
+                    if (previous->getHeader()->_items_count > 1) {
+                        auto [child, separator] = previous->popRightChild();
+                        parent->append(level[i - 1].first, child, fillFactor);
+                        parents.back().first = separator;
+                    }
+                    unlatch(previous);
+                }
+
+                // the child that closes a parent becomes its rightmost child
+                for (; i + 1 < level.size() && parent->append(level[i].first, level[i].second, fillFactor); i++) {
+                }
+                parent->setRightChild(level[i].second);
+                if (!parents.empty()) {
+                    auto previous = BTreeInternalNode<TKey>::getNode(parents.back().second);
+                    latch(previous);
+                    LinkRightSibling(previous->getHeader(), parent->getHeader());
+                    unlatch(previous);
+                }
+                unlatch(parent);
+                parents.emplace_back(level[i].first, parentPid);
+                i++;
+            }
+            level = std::move(parents);
+        }
+
+        // the top node moves into the root page so the root PID doesn't change. Readers may be
+        // watching the root, it is always latched.
+        BufferCache::Scope scope(BufferCacheInstance, true);
+        auto top = GetPageHeader(level[0].second);
+        auto rootNode = getRoot();
+        auto root = rootNode->getHeader();
+        rootNode->writeLock();
+        CopyPage((unsigned char*)root, (unsigned char*)top);
+        root->_pid = _root_pid;
+        root->_p_pid = InvalidPid;
+        SetNodeType(&root->_info, RootNode | (top->_info & (LeafNode | IntermediateNode)));
+        if (!IsLeafNode(root->_info))
+            BTreeInternalNode<TKey>::getNode(_root_pid)->reparentChildren();
+        rootNode->writeUnlock();
+        BufferCacheInstance.free(level[0].second);
+        return pages;
+    }
+
+private:
+    BTreeNode<TKey,TVal>* getRoot() { return BTreeNode<TKey,TVal>::getNode(_root_pid); }
+
+    uint32_t _root_pid;
+};
 
 template <typename TKey, typename TVal>
 static BTreeNode<TKey, TVal> GetBTreeNode(uint32_t pid) {
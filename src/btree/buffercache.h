@@ -1,47 +1,1905 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <fstream>
 #include <format>
+#include <linux/falloc.h>
+#include <linux/mempolicy.h>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <set>
 #include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
+#include "crc32c.h"
+#include "iouring.h"
+#include "lz.h"
+#include "wal.h"
 
 // Page size in bytes
 constexpr uint32_t PageSize = 8 * 1024;
 
+// Superblock at page 0 of a BufferCache file. The pids of the free list follow it to the end of
+// the page, the rest of the list continues in trunk pages written after the last page in use.
+// The trunk pages count as in use until the next superblock is written, so no page overwrites
+// them before, pages past _next_free_page start zeroed.
+struct BufferCacheSuperblock {
+    uint64_t _magic;
+    uint32_t _page_size;
+    uint32_t _next_free_page;
+    uint32_t _root_pid;
+    // Free pids stored in the superblock
+    uint32_t _free_count;
+    // First trunk page of the free list, UINT32_MAX when there is none
+    uint32_t _free_trunk_pid;
+    uint32_t _reserved;
+    // LSN recovery starts at, every change before it is in the pages of the file
+    uint64_t _checkpoint_lsn;
+    // LSN of the first byte of the log file
+    uint64_t _log_lsn;
+};
+
+// Trunk page of the free list: the next trunk pid, the number of pids, then the pids
+struct BufferCacheFreeTrunk {
+    uint32_t _next_pid;
+    uint32_t _count;
+};
+
+constexpr uint64_t BufferCacheMagic = 0x4254524545504734; // "BTREEPG4"
+constexpr uint32_t SuperblockFreeCapacity = (PageSize - sizeof(BufferCacheSuperblock)) / sizeof(uint32_t);
+constexpr uint32_t TrunkFreeCapacity = (PageSize - sizeof(BufferCacheFreeTrunk)) / sizeof(uint32_t);
+
+// Pages of a durable cache keep the LSN of the last logged change to them at this offset
+constexpr uint32_t PageLsnOffset = 40;
+// Pages keep the word of their optimistic latch at this offset. It is held while a page is
+// logged, so the log has it zeroed.
+constexpr uint32_t PageVersionOffset = 4;
+// Bit of the word at PageVersionOffset set while a writer holds the page latched
+constexpr uint32_t PageLatchedBit = 0x2;
+// Pages of a file backed cache carry the CRC32C of their bytes as written at this offset, with
+// the checksum itself taken as zero
+constexpr uint32_t PageChecksumOffset = 24;
+
+// Read paths verifying the checksums of the pages they bring in, for setChecksumReads(). Pages
+// found in the cache are never verified again.
+// Synchronous misses of get() and of writers
+constexpr uint32_t ChecksumMissReads = 1;
+// Reads of awaited fetch() calls
+constexpr uint32_t ChecksumFetchReads = 2;
+// Pages read ahead of scans
+constexpr uint32_t ChecksumReadAheadReads = 4;
+constexpr uint32_t ChecksumAllReads = ChecksumMissReads | ChecksumFetchReads | ChecksumReadAheadReads;
+
+// A page the file holds compressed starts with this header in place of its own, followed by its
+// compressed bytes. Pages keep the high byte of their first 16 bits clear, PackedPageMagic has
+// it set.
+struct BufferPackedPage {
+    uint32_t _magic;
+    // Bytes of the compressed page after the header
+    uint32_t _size;
+};
+
+constexpr uint32_t PackedPageMagic = 0x4B43FF50;
+// A compressed page takes whole blocks of this size at the start of its slot in the file, the
+// rest of the slot is a hole. Pages that don't save a block are written as they are.
+constexpr size_t PackedPageBlockSize = 4096;
+
+// Which write-backs compress pages. Evicted compresses the pages the CLOCK sweep and the scan
+// ring evict, the cold ones, and writes pages that stay cached, such as those of flush() and of
+// checkpoints, as they are. Hot pages are written back again and again and would pay for the
+// compression each time. All compresses every write-back.
+enum class PageCompression { Off, Evicted, All };
+// The log of a durable cache is kept next to its file, under the file name with this suffix
+constexpr const char* WalFileSuffix = ".wal";
+
+// Size of the huge pages the arena is backed by when it can be
+constexpr size_t ArenaHugePageSize = 2 * 1024 * 1024;
+
+// How the arena memory is backed. HugeTlb takes pages reserved in /proc/sys/vm/nr_hugepages,
+// TransparentHugePages asks the kernel to back it with huge pages when it can.
+enum class ArenaBacking { HugeTlb, TransparentHugePages, SmallPages };
+
+// Submission slots of the ring a file backed cache reads and writes pages through
+constexpr unsigned PageRingEntries = 256;
+// The arena is registered with the ring in buffers of at most this size, the kernel limit
+constexpr size_t PageRingBufferSize = (size_t)1 << 30;
+// user_data of write-back completions. Reads for a PageFetch carry its address, read-ahead
+// reads carry their frame shifted left by one with PageRingReadAheadTag set.
+constexpr uint64_t PageRingWriteTag = 0;
+constexpr uint64_t PageRingReadAheadTag = 1;
+// user_data of write-backs of compressed pages, which are shorter than a page
+constexpr uint64_t PageRingPackedWriteTag = 2;
+// Frames the pages of scans are recycled through before they take frames from point lookups
+constexpr uint32_t ScanRingFrames = 256;
+
+// The background checkpointer wakes up this often, and starts a checkpoint by default once the
+// log grew by CheckpointLogBytes since the last one
+constexpr auto CheckpointTick = std::chrono::milliseconds(10);
+constexpr uint64_t CheckpointLogBytes = 4 * 1024 * 1024;
+// Pages a checkpoint copies and writes at a time, it holds them pinned meanwhile
+constexpr uint32_t CheckpointBatchPages = 8;
+
+// Frame of the arena holding one page of a file backed cache
+struct BufferFrame {
+    // PID of the page in the frame, UINT32_MAX when the frame is empty
+    std::atomic<uint32_t> _pid = UINT32_MAX;
+
+    // Scopes holding the page pinned, a pinned page is never evicted. The CLOCK sweep sets
+    // EvictingPin while it replaces the page, pins taken meanwhile are backed out.
+    std::atomic<uint32_t> _pins = 0;
+
+    // Set by every access, the CLOCK hand clears it and evicts frames it finds cleared
+    std::atomic<bool> _referenced = false;
+
+    // The page changed since it was last written to the file
+    std::atomic<bool> _dirty = false;
+
+    // The page was brought in by a scan and sits in the scan ring until a point access takes it
+    // out of there
+    std::atomic<bool> _scan = false;
+
+    // write() calls changing the page right now
+    std::atomic<uint32_t> _writers = 0;
+};
+
+constexpr uint32_t EvictingPin = 1u << 31;
+
+// Frames pinned by the BufferCache::Scopes of a thread
+struct BufferPinList {
+    std::vector<uint32_t> _frames;
+
+    // Scopes open on the thread
+    int _depth = 0;
+
+    // A writing Scope is open
+    bool _writing = false;
+
+    // A scanning Scope is open, its misses go to the scan ring and its hits don't count as
+    // references
+    bool _scanning = false;
+};
+
+// Changes of a thread to the pages of a durable cache that are not logged yet
+struct BufferPageWrites {
+    // Frames the thread holds latched with the page as it was when it was latched. Entries
+    // from _latched on are spare.
+    std::vector<std::pair<uint32_t, std::unique_ptr<unsigned char[]>>> _images;
+    size_t _latched = 0;
+
+    // Frames of the pages the thread allocated, they are logged whole
+    std::vector<uint32_t> _newFrames;
+
+    // Payload of the record being built
+    std::vector<unsigned char> _record;
+
+    // LSN of the last record of the thread, made durable when its outermost Scope ends
+    uint64_t _lsn = 0;
+};
+
+// Open addressed map from PIDs to frames with linear probing. Lookups take no latch, inserts
+// and erases are serialized by the BufferCache. An erase shifts the entries after it back, a
+// lookup racing with it may miss an entry that is there, so callers retry a miss under the
+// latch. A frame found without the latch may already hold another page and is checked after
+// pinning it.
+class BufferPageTable {
+public:
+    // Size the table for frames entries, it stays at most half full
+    void reset(uint32_t frames) {
+        _mask = 1;
+        while (_mask < 2 * (size_t)frames)
+            _mask <<= 1;
+        _slots = std::make_unique<std::atomic<uint64_t>[]>(_mask);
+        _mask--;
+        clear();
+    }
+
+    void clear() {
+        for (size_t slot = 0; slot <= _mask; slot++)
+            _slots[slot].store(EmptyEntry, std::memory_order_relaxed);
+    }
+
+    // Frame of pid, UINT32_MAX when it is not found
+    uint32_t find(uint32_t pid) const {
+        auto slot = home(pid);
+        for (size_t probe = 0; probe <= _mask; probe++, slot = (slot + 1) & _mask) {
+            auto entry = _slots[slot].load(std::memory_order_acquire);
+            if (entry == EmptyEntry)
+                break;
+            if ((uint32_t)(entry >> 32) == pid)
+                return (uint32_t)entry;
+        }
+        return UINT32_MAX;
+    }
+
+    void insert(uint32_t pid, uint32_t frame) {
+        auto slot = home(pid);
+        while (_slots[slot].load(std::memory_order_relaxed) != EmptyEntry)
+            slot = (slot + 1) & _mask;
+        _slots[slot].store((uint64_t)pid << 32 | frame, std::memory_order_release);
+    }
+
+    void erase(uint32_t pid) {
+        auto slot = home(pid);
+        while ((uint32_t)(_slots[slot].load(std::memory_order_relaxed) >> 32) != pid)
+            slot = (slot + 1) & _mask;
+
+        // move back every later entry of the run that may live at slot, the hole ends the run
+        for (auto next = (slot + 1) & _mask;; next = (next + 1) & _mask) {
+            auto entry = _slots[next].load(std::memory_order_relaxed);
+            if (entry == EmptyEntry)
+                break;
+            auto entryHome = home((uint32_t)(entry >> 32));
+            if (((next - entryHome) & _mask) >= ((next - slot) & _mask)) {
+                _slots[slot].store(entry, std::memory_order_release);
+                slot = next;
+            }
+        }
+        _slots[slot].store(EmptyEntry, std::memory_order_release);
+    }
+
+private:
+    static constexpr uint64_t EmptyEntry = UINT64_MAX;
+
+    size_t home(uint32_t pid) const { return (size_t)((pid * 0x9E3779B97F4A7C15ull) >> 32) & _mask; }
+
+    std::unique_ptr<std::atomic<uint64_t>[]> _slots;
+    size_t _mask = 0;
+};
+
+// Per core state of a BufferCache. A core allocates from its own free list and only takes pages
+// from the others when its list runs dry, so allocation-heavy writers on different cores don't
+// share a latch. Hits are counted per core too, one shared counter would bounce between caches.
+struct alignas(64) BufferCacheShard {
+    std::mutex _mutex;
+    std::vector<uint32_t> _freePids;
+    // Size of _freePids, read without the latch to skip empty lists
+    std::atomic<uint32_t> _free_count = 0;
+    std::atomic<uint64_t> _hits = 0;
+};
+
+// Page memory for all pages of a process. It is an in-memory arena where page pid lives at
+// pid * PageSize until open() backs it by a file. Then the arena is split into frames, a page
+// table maps the PIDs of the cached pages to frames, and pages are read from the file on a miss.
+// The CLOCK sweep evicts unpinned frames and writes dirty ones back first. Page pid lives at
+// file offset pid * PageSize and page 0 holds the superblock. Cached pages are found without a
+// latch, _rwMutex is only taken to bring a page in and the free list is split per core.
+//
+// When the kernel has io_uring, an awaited fetch() reads a missing page through a ring over the
+// arena instead of blocking, and flush() writes dirty pages back in batches through it. get()
+// still reads misses with pread.
+//
+// Every page written to the file gets a CRC32C, checked when the page is read back in, so a
+// page the disk or a torn write damaged fails the read instead of feeding garbage to the tree.
+// A page that is all zeroes was never written and passes.
+//
+// A durable cache logs every change to its pages to a WriteAheadLog, and a writing Scope waits
+// for its changes to be in the log before it ends. Writers bracket each change with
+// beginWrite() and endWrite() while they hold the page latched, which logs the bytes that
+// changed, pages they allocate are logged whole. A page is written back only once the log holds
+// its changes, and flush() is a checkpoint after which the log starts over. Opening a file
+// whose log has records redoes them on the pages.
+//
+// A durable cache can also checkpoint while pages change, in the background at a given rate.
+// Such a checkpoint writes a copy of every page changed since it was last written, taken while
+// no writer has the page latched, then records the LSN it started at as the one recovery starts
+// from. The log before it is given back to the file system.
 class BufferCache {
 public:
-    BufferCache(uint32_t pages) : _pages(pages), _next_free_page(0) {
-        _ptr = new unsigned char[_pages * PageSize];
+    // Pins the pages get() and initNextFreePage() return on this thread until the outermost
+    // Scope of the thread ends, so a file backed cache doesn't evict them meanwhile. Pages
+    // fetched while a writing Scope is open are marked dirty when they are unpinned. Pages a
+    // scanning Scope reads are evicted before those of point lookups.
+    class Scope {
+    public:
+        Scope(BufferCache& cache, bool writing, bool scanning = false) : _cache(cache) {
+            ThreadPins._writing = ThreadPins._writing || writing;
+            ThreadPins._scanning = ThreadPins._scanning || scanning;
+            ThreadPins._depth++;
+        }
+
+        // waits for the log when the Scope changed pages of a durable cache
+        ~Scope() noexcept(false) {
+            if (--ThreadPins._depth == 0)
+                _cache.endScope();
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        BufferCache& _cache;
+    };
+
+    // Pin handed out by an awaited fetch(). The page stays in its frame until the pin is
+    // destroyed.
+    class PagePin {
+    public:
+        PagePin() = default;
+
+        PagePin(PagePin&& other) noexcept : _cache(std::exchange(other._cache, nullptr)), _frame(other._frame) {}
+
+        PagePin& operator=(PagePin&& other) noexcept {
+            release();
+            _cache = std::exchange(other._cache, nullptr);
+            _frame = other._frame;
+            return *this;
+        }
+
+        ~PagePin() { release(); }
+
+    private:
+        friend class BufferCache;
+
+        PagePin(BufferCache* cache, uint32_t frame) : _cache(cache), _frame(frame) {}
+
+        void release() {
+            if (_cache != nullptr)
+                _cache->_frames[_frame]._pins.fetch_sub(1, std::memory_order_release);
+            _cache = nullptr;
+        }
+
+        BufferCache* _cache = nullptr;
+        uint32_t _frame = 0;
+    };
+
+    // Awaitable that pins page pid. A coroutine awaiting a page that is not cached is suspended
+    // while the page is read through the ring, and resumed by poll(). Cached pages, the pages of
+    // an in-memory arena and all pages when there is no ring are there without suspending.
+    class PageFetch {
+    public:
+        PageFetch(BufferCache& cache, uint32_t pid) : _cache(cache), _pid(pid) {}
+
+        bool await_ready() { return _cache.fetchCached(this); }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            _handle = handle;
+            return _cache.startFetch(this);
+        }
+
+        PagePin await_resume() {
+            if (_error != 0)
+                throw std::runtime_error(std::string("Failed to read page: ") + std::strerror(_error));
+            return _frame == UINT32_MAX ? PagePin() : PagePin(&_cache, _frame);
+        }
+
+    private:
+        friend class BufferCache;
+
+        BufferCache& _cache;
+        uint32_t _pid;
+        uint32_t _frame = UINT32_MAX;
+        int _error = 0;
+        std::coroutine_handle<> _handle;
+    };
+
+    // A cache of pages pages. With interleaveNodes the arena memory is spread over the NUMA
+    // nodes page by page, so no node serves all the misses of random lookups. An arena backed by
+    // huge pages takes all of its memory here.
+    BufferCache(uint32_t pages, bool interleaveNodes = false) : _pages(pages), _next_free_page(0), _root_pid(UINT32_MAX), _fd(-1),
+        _frame_count(0), _clock_hand(0), _file_pages(0), _misses(0), _reads_in_flight(0) {
+        _shard_count = std::max(1u, std::thread::hardware_concurrency());
+        _shards = std::make_unique<BufferCacheShard[]>(_shard_count);
+        allocateArena(interleaveNodes);
+    }
+
+    ~BufferCache() {
+        if (_checkpointer.joinable()) {
+            _checkpointer_stop = true;
+            _checkpointerWake.notify_all();
+            _checkpointer.join();
+        }
+        if (_fd >= 0)
+            ::close(_fd);
+        munmap(_ptr, _arena_size);
     }
-    
+
     uint32_t initNextFreePage(unsigned char** page) {
-        std::unique_lock<std::shared_mutex> lock(_rwMutex);
-        auto pid = 0;
-        if (_freeList.size() > 0) {
-            pid = _freeList.back();
-            _freeList.pop_back();
-        } else {
-            pid = _next_free_page++;
-        }
-        
-        *page = _ptr +  pid * PageSize;
+        auto pid = takeFreePage();
+        auto fresh = pid == UINT32_MAX;
+        if (fresh) {
+            pid = _next_free_page.load(std::memory_order_relaxed);
+            do {
+                // an in-memory arena has no room beyond its pages
+                if (_fd < 0 && pid >= _pages)
+                    throw std::runtime_error("Buffer cache is full");
+            } while (!_next_free_page.compare_exchange_weak(pid, pid + 1, std::memory_order_relaxed));
+        }
+
+        if (_fd < 0) {
+            // pages start zeroed, a recycled page keeps its content for the caller to reset
+            *page = _ptr + (size_t)pid * PageSize;
+            if (fresh)
+                std::memset(*page, 0, PageSize);
+            return pid;
+        }
+
+        // a recycled page is read back, its _version has to keep growing
+        auto frame = fix(pid, fresh);
+        _frames[frame]._dirty.store(true, std::memory_order_relaxed);
+        *page = _ptr + (size_t)frame * PageSize;
+        if (_wal.isOpen() && ThreadPins._depth > 0)
+            ThreadWrites._newFrames.push_back(frame);
         return pid;
     }
-    
+
     void free(uint32_t pid) {
-        std::unique_lock<std::shared_mutex> lock(_rwMutex);
-        _freeList.push_back(pid);
+        if (_wal.isOpen()) {
+            auto& newFrames = ThreadWrites._newFrames;
+            std::erase_if(newFrames, [this, pid](uint32_t frame) { return _frames[frame]._pid.load(std::memory_order_relaxed) == pid; });
+            noteRecord(_wal.append(WalRecordType::FreePage, pid, {}));
+        }
+
+        auto& shard = localShard();
+        std::lock_guard<std::mutex> lock(shard._mutex);
+        shard._freePids.push_back(pid);
+        shard._free_count.store(shard._freePids.size(), std::memory_order_relaxed);
     }
-    
+
     unsigned char* get(uint32_t pid) {
-        return _ptr + pid * PageSize;
+        if (_fd < 0)
+            return _ptr + (size_t)pid * PageSize;
+
+        return _ptr + (size_t)fix(pid, false) * PageSize;
+    }
+
+    // Write size bytes of data at offset of page pid without keeping it pinned for the Scope.
+    // Writers that touch more pages than there are frames, such as a split reparenting the
+    // children it moves, and writers of a field of a page they don't hold latched go through
+    // here. A file backed page is marked dirty right away, a durable cache logs the bytes.
+    void write(uint32_t pid, uint32_t offset, const void* data, uint32_t size) {
+        if (_fd < 0) {
+            std::memcpy(_ptr + (size_t)pid * PageSize + offset, data, size);
+            return;
+        }
+
+        auto frame = fix(pid, false, false);
+        auto page = _ptr + (size_t)frame * PageSize;
+        // a checkpoint doesn't copy the page until the change is logged and marked dirty
+        _frames[frame]._writers.fetch_add(1);
+        std::memcpy(page + offset, data, size);
+        if (_wal.isOpen()) {
+            auto& record = ThreadWrites._record;
+            record.clear();
+            appendRun(record, page, offset, size);
+            auto lsn = _wal.append(WalRecordType::PageDelta, pid, record);
+            setPageLsn(page, lsn);
+            noteRecord(lsn);
+        }
+        _frames[frame]._dirty.store(true, std::memory_order_relaxed);
+        _frames[frame]._writers.fetch_sub(1, std::memory_order_release);
+        _frames[frame]._pins.fetch_sub(1, std::memory_order_release);
     }
-    
+
+    // Take the image of page, which the caller just latched to change it. No-op unless the
+    // cache is durable.
+    void beginWrite(const unsigned char* page) {
+        if (!_wal.isOpen())
+            return;
+
+        auto& writes = ThreadWrites;
+        if (writes._latched == writes._images.size())
+            writes._images.emplace_back(0, std::make_unique<unsigned char[]>(PageSize));
+        auto& image = writes._images[writes._latched++];
+        image.first = frameOf(page);
+        std::memcpy(image.second.get(), page, PageSize);
+    }
+
+    // Log the bytes of page that changed since beginWrite(), before the caller releases its
+    // latch. The pages the thread allocated meanwhile are logged first, the page may link to
+    // them.
+    void endWrite(unsigned char* page) {
+        if (!_wal.isOpen())
+            return;
+
+        logNewPages();
+        auto frame = frameOf(page);
+        auto& writes = ThreadWrites;
+        for (size_t i = 0; i < writes._latched; i++) {
+            if (writes._images[i].first != frame)
+                continue;
+            logChanges(frame, writes._images[i].second.get());
+            std::swap(writes._images[i], writes._images[--writes._latched]);
+            return;
+        }
+    }
+
+    // Whether the cache logs its changes
+    bool isDurable() const { return _wal.isOpen(); }
+
+    // Verify the checksums of the pages read on the paths in reads, a mask of the Checksum*Reads
+    // bits. All of them do by default.
+    void setChecksumReads(uint32_t reads) { _checksum_reads.store(reads, std::memory_order_relaxed); }
+
+    // Pages whose checksum didn't match when they were read, or that didn't decompress
+    uint64_t getChecksumFailureCount() const { return _checksum_failures.load(std::memory_order_relaxed); }
+
+    // Compress the pages written back to the file from now on, those that mode covers. Pages
+    // stay uncompressed in the cache and are decompressed as they are read in, whatever the mode.
+    void setPageCompression(PageCompression mode) { _page_compression.store(mode, std::memory_order_relaxed); }
+
+    // Pages written back compressed
+    uint64_t getPackedPageCount() const { return _packed_pages.load(std::memory_order_relaxed); }
+
+    // Writes of the log, each makes the changes of a group of writing Scopes durable
+    uint64_t getLogWriteCount() { return _wal.isOpen() ? _wal.getWriteCount() : 0; }
+
+    PageFetch fetch(uint32_t pid) { return PageFetch(*this, pid); }
+
+    // Submit the queued page reads and resume the fetches whose pages arrived, on this thread.
+    // Waits for a read to complete first when wait is set and reads are in flight. Returns the
+    // number of fetches resumed.
+    size_t poll(bool wait = true) {
+        if (!_ring.isActive())
+            return 0;
+
+        std::vector<uint64_t> failed;
+        {
+            std::lock_guard<std::mutex> ringLock(_ringMutex);
+            drainRing(wait && _reads_in_flight > 0 ? 1 : 0, &failed);
+        }
+        {
+            std::unique_lock<std::shared_mutex> lock(_rwMutex);
+            dropFailedReads(failed);
+            resolveWaitingFetches();
+        }
+
+        std::vector<PageFetch*> ready;
+        {
+            std::lock_guard<std::mutex> ringLock(_ringMutex);
+            ready.swap(_readyFetches);
+        }
+        for (auto fetch : ready)
+            fetch->_handle.resume();
+        return ready.size();
+    }
+
+    ArenaBacking getArenaBacking() const { return _arena_backing; }
+
+    // NUMA nodes the arena is interleaved over, 1 when it is not
+    uint32_t getArenaNodeCount() const { return _arena_nodes; }
+
+    // Start reading the pages of pids that are not cached, for a scan about to reach them. The
+    // pages go to the scan ring. Without a ring the pages are read when they are reached, and
+    // read-ahead stops early when every frame is pinned.
+    void readAhead(std::span<const uint32_t> pids) {
+        if (!_ring.isActive())
+            return;
+
+        std::vector<uint64_t> failed;
+        std::unique_lock<std::shared_mutex> lock(_rwMutex);
+        {
+            std::lock_guard<std::mutex> ringLock(_ringMutex);
+            auto opcode = _fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            for (auto pid : pids) {
+                if (pid == UINT32_MAX || _pageTable.find(pid) != UINT32_MAX)
+                    continue;
+                auto frame = evict(false);
+                if (frame == UINT32_MAX)
+                    break;
+
+                _frames[frame]._pid.store(pid, std::memory_order_release);
+                _pageTable.insert(pid, frame);
+                enterScanRing(frame);
+                _read_aheads++;
+                if (pid >= _file_pages) {
+                    std::memset(_ptr + (size_t)frame * PageSize, 0, PageSize);
+                    _frames[frame]._pins.fetch_sub(EvictingPin, std::memory_order_release);
+                    continue;
+                }
+
+                auto userData = (uint64_t)frame << 1 | PageRingReadAheadTag;
+                while (!_ring.prepare(opcode, _fd, _ptr + (size_t)frame * PageSize, PageSize, (uint64_t)pid * PageSize, userData, bufferIndex(frame)))
+                    drainRing(0, &failed);
+                _reads_in_flight++;
+            }
+            // nobody may poll, the reads start now
+            drainRing(0, &failed);
+        }
+        dropFailedReads(failed);
+    }
+
+    // Pages readAhead() started reading
+    uint64_t getReadAheadCount() { return _read_aheads.load(std::memory_order_relaxed); }
+
+    // Whether misses of fetch() go through io_uring
+    bool isAsync() const { return _ring.isActive(); }
+
+    uint32_t getFreePageCount() {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < _shard_count; i++)
+            count += _shards[i]._free_count.load(std::memory_order_relaxed);
+        return count;
+    }
+
+    // Page lookups of a file backed cache that found the page in a frame, and that read it
+    uint64_t getHitCount() {
+        uint64_t hits = 0;
+        for (uint32_t i = 0; i < _shard_count; i++)
+            hits += _shards[i]._hits.load(std::memory_order_relaxed);
+        return hits;
+    }
+
+    uint64_t getMissCount() { return _misses.load(std::memory_order_relaxed); }
+
+    double getHitRate() {
+        auto hits = getHitCount();
+        auto total = hits + getMissCount();
+        return total == 0 ? 1.0 : (double)hits / total;
+    }
+
+    // Root PID of the tree kept in the file, UINT32_MAX until it is set
+    uint32_t getRootPid() { return _root_pid; }
+
+    void setRootPid(uint32_t pid) {
+        _root_pid = pid;
+        if (_wal.isOpen())
+            _wal.flush(_wal.append(WalRecordType::RootPid, pid, {}));
+    }
+
+    // Back the cache by the file at path, caching at most frames of its pages, or as many as the
+    // arena holds when frames is 0. Pages of an existing file keep their PIDs and are read on
+    // first access, otherwise the file is created. A durable cache logs its changes next to the
+    // file. The changes a log left by a crash holds are redone either way. The cache must not
+    // hold any page yet.
+    void open(const std::string& path, uint32_t frames = 0, bool durable = false) {
+        std::unique_lock<std::shared_mutex> lock(_rwMutex);
+        if (_fd >= 0 || _next_free_page > 0)
+            throw std::runtime_error("Buffer cache is in use");
+
+        _fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_DIRECT, 00666);
+        // file systems such as tmpfs reject O_DIRECT, they get buffered I/O synced on flush
+        if (_fd < 0 && errno == EINVAL)
+            _fd = ::open(path.c_str(), O_CREAT | O_RDWR, 00666);
+        if (_fd < 0)
+            throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+
+        _frame_count = frames == 0 ? _pages : std::min(frames, _pages);
+        _frames = std::make_unique<BufferFrame[]>(_frame_count);
+        _pageTable.reset(_frame_count);
+        _clock_hand = 0;
+        for (uint32_t i = 0; i < _shard_count; i++)
+            _shards[i]._hits = 0;
+        _misses = 0;
+        openRing();
+        try {
+            // the last page ends early when it is compressed
+            _file_pages = (lseek(_fd, 0, SEEK_END) + PageSize - 1) / PageSize;
+            if (_file_pages == 0) {
+                _next_free_page = 1;
+                writeSuperblock();
+            } else
+                load();
+        } catch (...) {
+            _ring.close();
+            ::close(_fd);
+            _fd = -1;
+            _next_free_page = 0;
+            clearFreeLists();
+            throw;
+        }
+        lock.unlock();
+
+        _log_path = path + WalFileSuffix;
+        if (durable || access(_log_path.c_str(), F_OK) == 0) {
+            recover();
+            if (!durable) {
+                _wal.close();
+                unlink(_log_path.c_str());
+            }
+        }
+    }
+
+    // Write the dirty pages, the root PID and the free list to the file. A durable cache then
+    // starts its log over. Pages must not change while it runs.
+    void flush() {
+        // a background checkpoint gives way, this one covers everything it would
+        _checkpoint_yield = true;
+        std::lock_guard<std::mutex> checkpointLock(_checkpointMutex);
+        _checkpoint_yield = false;
+        std::unique_lock<std::shared_mutex> lock(_rwMutex);
+        if (_fd < 0)
+            throw std::runtime_error("Buffer cache is not backed by a file");
+        if (_wal.isOpen())
+            _wal.flush(_wal.getEndLsn());
+
+        // in PID order, so runs of pages land sequentially in the file
+        std::vector<std::pair<uint32_t, uint32_t>> dirty;
+        for (uint32_t frame = 0; frame < _frame_count; frame++) {
+            auto pid = _frames[frame]._pid.load(std::memory_order_relaxed);
+            if (pid != UINT32_MAX && _frames[frame]._dirty.load(std::memory_order_acquire))
+                dirty.emplace_back(pid, frame);
+        }
+        std::sort(dirty.begin(), dirty.end());
+        if (_ring.isActive())
+            writeFrames(dirty);
+        else
+            for (auto [pid, frame] : dirty)
+                writeFrame(frame);
+        // the log starts again past the LSN of every page
+        if (_wal.isOpen())
+            _checkpoint_lsn = _log_lsn = (_wal.getEndLsn() + WalBlockSize - 1) / WalBlockSize * WalBlockSize;
+        writeSuperblock();
+        if (_wal.isOpen())
+            _wal.restart(_checkpoint_lsn);
+    }
+
+    // Write a copy of every page of a durable cache that changed since it was last written, and
+    // make recovery start from the LSN the log ended at when it began. Pages may change while it
+    // runs, the pages a writer holds latched are copied once it lets go of them.
+    void checkpoint() { runCheckpoint(0, 1); }
+
+    // Checkpoint in the background whenever the log grew by logBytes since the last checkpoint,
+    // writing at most pagesPerSecond pages a second. The checkpointer thread runs at the idle
+    // priority of the scheduler, so it only takes cycles no other thread wants.
+    void startCheckpointer(uint32_t pagesPerSecond, uint64_t logBytes = CheckpointLogBytes) {
+        if (!_wal.isOpen())
+            throw std::runtime_error("Buffer cache is not durable");
+        if (_checkpointer.joinable())
+            throw std::runtime_error("Checkpointer is running");
+
+        _checkpointer_stop = false;
+        _checkpointer_error = nullptr;
+        _checkpointer = std::thread([this, pagesPerSecond, logBytes]() {
+            sched_param param{};
+            pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+            auto pagesPerTick = std::max(1u, pagesPerSecond / (uint32_t)(std::chrono::seconds(1) / CheckpointTick));
+            try {
+                while (pause(CheckpointTick))
+                    runCheckpoint(pagesPerTick, logBytes);
+            } catch (...) {
+                _checkpointer_error = std::current_exception();
+            }
+        });
+    }
+
+    // Stop the checkpointer, rethrowing what stopped it earlier. A checkpoint it is in the
+    // middle of is abandoned, recovery starts from the last one it finished.
+    void stopCheckpointer() {
+        if (!_checkpointer.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(_checkpointerMutex);
+            _checkpointer_stop = true;
+        }
+        _checkpointerWake.notify_all();
+        _checkpointer.join();
+        if (_checkpointer_error)
+            std::rethrow_exception(std::exchange(_checkpointer_error, nullptr));
+    }
+
+    // Checkpoints finished since the cache was opened, and the pages they wrote
+    uint64_t getCheckpointCount() const { return _checkpoints.load(std::memory_order_relaxed); }
+    uint64_t getCheckpointPageCount() const { return _checkpoint_pages.load(std::memory_order_relaxed); }
+
+    // Pages a second the last checkpoint wrote, which the rate of the checkpointer caps
+    uint64_t getCheckpointPageRate() const { return _checkpoint_page_rate.load(std::memory_order_relaxed); }
+
+    // Share of the frames holding a page that changed since it was last written
+    double getDirtyRatio() const {
+        uint32_t dirty = 0;
+        for (uint32_t frame = 0; frame < _frame_count; frame++)
+            dirty += _frames[frame]._dirty.load(std::memory_order_relaxed);
+        return _frame_count == 0 ? 0 : (double)dirty / _frame_count;
+    }
+
+    // Flush and detach the file if there is one, then drop all pages. The cache is an empty
+    // in-memory arena again. No fetch may be in flight.
+    void close() {
+        stopCheckpointer();
+        if (_fd >= 0)
+            flush();
+
+        std::unique_lock<std::shared_mutex> lock(_rwMutex);
+        if (_wal.isOpen()) {
+            // the checkpoint left nothing to redo
+            _wal.close();
+            unlink(_log_path.c_str());
+        }
+        _ring.close();
+        _waitingFetches.clear();
+        _readyFetches.clear();
+        _scanFrames.clear();
+        if (_fd >= 0)
+            ::close(_fd);
+        _fd = -1;
+        _next_free_page = 0;
+        _root_pid = UINT32_MAX;
+        _checkpoint_lsn = 0;
+        _log_lsn = 0;
+        _checkpoints = 0;
+        _checkpoint_pages = 0;
+        _checkpoint_page_rate = 0;
+        _trunk_pids.clear();
+        clearFreeLists();
+        _pageTable.reset(0);
+        _frames.reset();
+        _frame_count = 0;
+    }
+
 private:
+    static inline thread_local BufferPinList ThreadPins;
+    static inline thread_local BufferPageWrites ThreadWrites;
+
+    // Map the arena. Random lookups touch a new page nearly every access, so it is backed by
+    // huge pages to keep the TLB covering it: reserved ones when there are enough, otherwise
+    // transparent huge pages on a huge page aligned mapping. Mapped memory is page aligned for
+    // O_DIRECT either way.
+    void allocateArena(bool interleaveNodes) {
+        _arena_size = ((size_t)_pages * PageSize + ArenaHugePageSize - 1) / ArenaHugePageSize * ArenaHugePageSize;
+        auto arena = mmap(nullptr, _arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        _arena_backing = ArenaBacking::HugeTlb;
+        if (arena == MAP_FAILED) {
+            // an unaligned mapping can't be backed by huge pages at its ends, so map one huge
+            // page more and trim it to an aligned range
+            auto mapped = mmap(nullptr, _arena_size + ArenaHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped == MAP_FAILED)
+                throw std::runtime_error("Failed to allocate the buffer cache");
+            auto start = reinterpret_cast<uintptr_t>(mapped);
+            auto aligned = (start + ArenaHugePageSize - 1) / ArenaHugePageSize * ArenaHugePageSize;
+            if (aligned > start)
+                munmap(mapped, aligned - start);
+            munmap(reinterpret_cast<void*>(aligned + _arena_size), start + ArenaHugePageSize - aligned);
+            arena = reinterpret_cast<void*>(aligned);
+            _arena_backing = madvise(arena, _arena_size, MADV_HUGEPAGE) == 0 ? ArenaBacking::TransparentHugePages : ArenaBacking::SmallPages;
+        }
+        _ptr = static_cast<unsigned char*>(arena);
+
+        // the policy has to be in place before the first touch places the pages
+        _arena_nodes = 1;
+        if (interleaveNodes) {
+            unsigned long nodes[16] = {};
+            auto count = readOnlineNodes(nodes, sizeof(nodes) * 8);
+            if (count > 1 && syscall(SYS_mbind, _ptr, _arena_size, MPOL_INTERLEAVE, nodes, sizeof(nodes) * 8 + 1, 0) == 0)
+                _arena_nodes = count;
+        }
+
+        // a first touch of a huge page zeroes 2MB and may compact memory to find it, which would
+        // stall the workload at every new stretch of pages, so they are all faulted in now
+        if (_arena_backing != ArenaBacking::SmallPages && madvise(_ptr, _arena_size, MADV_POPULATE_WRITE) != 0)
+            for (size_t offset = 0; offset < _arena_size; offset += ArenaHugePageSize)
+                _ptr[offset] = 0;
+    }
+
+    // Set the bits of the online NUMA nodes below maxNodes in mask. Returns how many there are,
+    // 0 when the kernel doesn't say.
+    static uint32_t readOnlineNodes(unsigned long* mask, uint32_t maxNodes) {
+        // a list of ranges such as "0-1,3"
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string ranges;
+        if (!std::getline(online, ranges))
+            return 0;
+
+        uint32_t count = 0;
+        for (size_t pos = 0; pos < ranges.size();) {
+            auto end = ranges.find(',', pos);
+            auto range = ranges.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            auto dash = range.find('-');
+            auto first = (uint32_t)std::stoul(range);
+            auto last = dash == std::string::npos ? first : (uint32_t)std::stoul(range.substr(dash + 1));
+            for (auto node = first; node <= last && node < maxNodes; node++, count++)
+                mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+            pos = end == std::string::npos ? ranges.size() : end + 1;
+        }
+        return count;
+    }
+
+    BufferCacheShard& localShard() {
+        auto cpu = sched_getcpu();
+        return _shards[cpu < 0 ? 0 : (uint32_t)cpu % _shard_count];
+    }
+
+    // Pop a free PID, from the list of this core first. UINT32_MAX when every list is empty.
+    uint32_t takeFreePage() {
+        auto start = (uint32_t)(&localShard() - _shards.get());
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            auto& shard = _shards[(start + i) % _shard_count];
+            if (shard._free_count.load(std::memory_order_relaxed) == 0)
+                continue;
+            std::lock_guard<std::mutex> lock(shard._mutex);
+            if (shard._freePids.empty())
+                continue;
+            auto pid = shard._freePids.back();
+            shard._freePids.pop_back();
+            shard._free_count.store(shard._freePids.size(), std::memory_order_relaxed);
+            return pid;
+        }
+        return UINT32_MAX;
+    }
+
+    // Every free PID, for the superblock
+    std::vector<uint32_t> collectFreePages() {
+        std::vector<uint32_t> pids;
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            pids.insert(pids.end(), _shards[i]._freePids.begin(), _shards[i]._freePids.end());
+        }
+        return pids;
+    }
+
+    void clearFreeLists() {
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            _shards[i]._freePids.clear();
+            _shards[i]._free_count = 0;
+        }
+    }
+
+    // Frame holding pid, pinned for the Scope of the thread, or until the caller unpins it when
+    // scoped is false. A cached page is found without a latch. A page that is not cached is read
+    // from the file, or zeroed when fresh is set, into the frame the CLOCK sweep frees up.
+    uint32_t fix(uint32_t pid, bool fresh, bool scoped = true) {
+        auto frame = _pageTable.find(pid);
+        if (frame != UINT32_MAX && tryPin(frame, pid)) {
+            hold(frame, scoped);
+            localShard()._hits.fetch_add(1, std::memory_order_relaxed);
+            return frame;
+        }
+
+        // frames only change hands under the latch, so a pin taken here always holds
+        std::unique_lock<std::shared_mutex> lock(_rwMutex);
+        frame = _pageTable.find(pid);
+        while (frame != UINT32_MAX && isLoading(frame)) {
+            // a fetch is reading the page through the ring, help its read along
+            lock.unlock();
+            awaitReads();
+            lock.lock();
+            frame = _pageTable.find(pid);
+        }
+        if (frame != UINT32_MAX) {
+            _frames[frame]._pins.fetch_add(1, std::memory_order_acquire);
+            hold(frame, scoped);
+            localShard()._hits.fetch_add(1, std::memory_order_relaxed);
+            return frame;
+        }
+
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        frame = evict();
+        auto page = _ptr + (size_t)frame * PageSize;
+        if (fresh || pid >= _file_pages)
+            std::memset(page, 0, PageSize);
+        else {
+            readPages(pid, 1, page);
+            if (!loadPage(page, ChecksumMissReads)) {
+                _frames[frame]._pins.fetch_sub(EvictingPin, std::memory_order_release);
+                throw std::runtime_error("Page " + std::to_string(pid) + " failed its checksum");
+            }
+        }
+        _frames[frame]._pid.store(pid, std::memory_order_release);
+        _pageTable.insert(pid, frame);
+        if (ThreadPins._scanning)
+            enterScanRing(frame);
+        // the evicting pin turns into the caller's
+        _frames[frame]._pins.fetch_sub(EvictingPin - 1, std::memory_order_release);
+        hold(frame, scoped);
+        return frame;
+    }
+
+    // A page is read into frame and EvictingPin keeps everyone else out until it is there
+    bool isLoading(uint32_t frame) { return (_frames[frame]._pins.load(std::memory_order_acquire) & EvictingPin) != 0; }
+
+    // Pin the cached page of fetch, for PageFetch::await_ready
+    bool fetchCached(PageFetch* fetch) {
+        if (_fd < 0)
+            return true;
+
+        auto frame = _pageTable.find(fetch->_pid);
+        if (frame == UINT32_MAX || !tryPin(frame, fetch->_pid))
+            return false;
+        touch(frame);
+        localShard()._hits.fetch_add(1, std::memory_order_relaxed);
+        fetch->_frame = frame;
+        return true;
+    }
+
+    // Bring the page of fetch in. Returns true when fetch waits for poll() to resume it, false
+    // when its page is pinned already.
+    bool startFetch(PageFetch* fetch) {
+        if (!_ring.isActive()) {
+            fetch->_frame = fix(fetch->_pid, false, false);
+            return false;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(_rwMutex);
+        auto frame = _pageTable.find(fetch->_pid);
+        if (frame != UINT32_MAX) {
+            // another fetch reads the page already
+            if (isLoading(frame)) {
+                _waitingFetches.push_back(fetch);
+                return true;
+            }
+            _frames[frame]._pins.fetch_add(1, std::memory_order_acquire);
+            touch(frame);
+            localShard()._hits.fetch_add(1, std::memory_order_relaxed);
+            fetch->_frame = frame;
+            return false;
+        }
+
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        frame = evict();
+        _frames[frame]._pid.store(fetch->_pid, std::memory_order_release);
+        _pageTable.insert(fetch->_pid, frame);
+        fetch->_frame = frame;
+        auto page = _ptr + (size_t)frame * PageSize;
+        if (fetch->_pid >= _file_pages) {
+            std::memset(page, 0, PageSize);
+            finishRead(frame);
+            return false;
+        }
+
+        // the read is submitted with the others of the batch by the next poll
+        std::vector<uint64_t> failed;
+        {
+            std::lock_guard<std::mutex> ringLock(_ringMutex);
+            auto opcode = _fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            while (!_ring.prepare(opcode, _fd, page, PageSize, (uint64_t)fetch->_pid * PageSize, (uint64_t)fetch, bufferIndex(frame)))
+                drainRing(0, &failed);
+            _reads_in_flight++;
+        }
+        // failures only come with a full ring, they are dropped under the latch held here
+        dropFailedReads(failed);
+        return true;
+    }
+
+    // The read of frame is done, its EvictingPin turns into the pin of the fetch
+    void finishRead(uint32_t frame) {
+        _frames[frame]._referenced.store(true, std::memory_order_relaxed);
+        _frames[frame]._pins.fetch_sub(EvictingPin - 1, std::memory_order_release);
+    }
+
+    // Submit the queued entries and handle the completions that are ready, waiting for
+    // minComplete of them. Completed reads are queued for poll() to resume, failed ones are
+    // left in failed to be dropped under the latch. Called with _ringMutex held.
+    void drainRing(unsigned minComplete, std::vector<uint64_t>* failed) {
+        if (!_ring.submit(minComplete))
+            throw std::runtime_error(std::string("Failed to submit page I/O: ") + std::strerror(errno));
+
+        _ring.reap([this, failed](uint64_t userData, int result) {
+            if (userData == PageRingWriteTag || userData == PageRingPackedWriteTag) {
+                _writes_in_flight--;
+                auto written = userData == PageRingWriteTag ? result == (int)PageSize : result > 0 && result % PackedPageBlockSize == 0;
+                if (!written && _write_error == 0)
+                    _write_error = result < 0 ? -result : EIO;
+                return;
+            }
+
+            _reads_in_flight--;
+            auto readAhead = (userData & PageRingReadAheadTag) != 0;
+            auto frame = readAhead ? (uint32_t)(userData >> 1) : reinterpret_cast<PageFetch*>(userData)->_frame;
+            auto page = _ptr + (size_t)frame * PageSize;
+            // the last page of the file ends early when it is compressed
+            if (result >= 0 && result < (int)PageSize) {
+                std::memset(page + result, 0, PageSize - result);
+                result = PageSize;
+            }
+            if (!loadPage(page, readAhead ? ChecksumReadAheadReads : ChecksumFetchReads))
+                result = -EBADMSG;
+            if (result != (int)PageSize) {
+                if (!readAhead)
+                    reinterpret_cast<PageFetch*>(userData)->_error = result < 0 ? -result : EIO;
+                failed->push_back(userData);
+            } else if (readAhead)
+                // nobody waits for a page read ahead, it is just there to be found
+                _frames[frame]._pins.fetch_sub(EvictingPin, std::memory_order_release);
+            else {
+                auto fetch = reinterpret_cast<PageFetch*>(userData);
+                finishRead(fetch->_frame);
+                _readyFetches.push_back(fetch);
+            }
+        });
+    }
+
+    // Give the frames of failed reads back, their fetches resume with the error. Called with
+    // the latch held exclusively.
+    void dropFailedReads(std::vector<uint64_t>& failed) {
+        std::vector<PageFetch*> resumed;
+        for (auto userData : failed) {
+            auto fetch = (userData & PageRingReadAheadTag) == 0 ? reinterpret_cast<PageFetch*>(userData) : nullptr;
+            auto frame = fetch != nullptr ? fetch->_frame : (uint32_t)(userData >> 1);
+            _pageTable.erase(_frames[frame]._pid.load(std::memory_order_relaxed));
+            _frames[frame]._pid.store(UINT32_MAX, std::memory_order_release);
+            _frames[frame]._scan.store(false, std::memory_order_relaxed);
+            _frames[frame]._pins.fetch_sub(EvictingPin, std::memory_order_release);
+            if (fetch != nullptr) {
+                fetch->_frame = UINT32_MAX;
+                resumed.push_back(fetch);
+            }
+        }
+        if (resumed.empty())
+            return;
+        std::lock_guard<std::mutex> ringLock(_ringMutex);
+        _readyFetches.insert(_readyFetches.end(), resumed.begin(), resumed.end());
+    }
+
+    // Pin the pages of the fetches that waited for another fetch to read them. Called with the
+    // latch held exclusively.
+    void resolveWaitingFetches() {
+        std::vector<PageFetch*> waiting;
+        waiting.swap(_waitingFetches);
+        for (auto fetch : waiting) {
+            auto frame = _pageTable.find(fetch->_pid);
+            if (frame != UINT32_MAX && isLoading(frame)) {
+                _waitingFetches.push_back(fetch);
+                continue;
+            }
+
+            // a failed read leaves the page out of the cache, the waiter fails the same way
+            if (frame == UINT32_MAX)
+                fetch->_error = EIO;
+            else {
+                _frames[frame]._pins.fetch_add(1, std::memory_order_acquire);
+                fetch->_frame = frame;
+            }
+            std::lock_guard<std::mutex> ringLock(_ringMutex);
+            _readyFetches.push_back(fetch);
+        }
+    }
+
+    // Make progress on the reads in flight for a thread that waits on one of their pages
+    void awaitReads() {
+        std::vector<uint64_t> failed;
+        {
+            std::lock_guard<std::mutex> ringLock(_ringMutex);
+            drainRing(_reads_in_flight > 0 ? 1 : 0, &failed);
+        }
+        if (!failed.empty()) {
+            std::unique_lock<std::shared_mutex> lock(_rwMutex);
+            dropFailedReads(failed);
+        }
+        std::this_thread::yield();
+    }
+
+    // Set up the ring and register the frames with it, as few buffers as the kernel allows
+    void openRing() {
+        if (!_ring.init(PageRingEntries))
+            return;
+
+        std::vector<iovec> buffers;
+        auto size = (size_t)_frame_count * PageSize;
+        for (size_t offset = 0; offset < size; offset += PageRingBufferSize)
+            buffers.push_back({_ptr + offset, std::min(PageRingBufferSize, size - offset)});
+        _fixed_buffers = _ring.registerBuffers(buffers.data(), buffers.size());
+        _reads_in_flight = 0;
+        _read_aheads = 0;
+        _writes_in_flight = 0;
+        _write_error = 0;
+    }
+
+    // Registered buffer of frame, -1 when the buffers could not be registered
+    int bufferIndex(uint32_t frame) { return _fixed_buffers ? (int)((size_t)frame * PageSize / PageRingBufferSize) : -1; }
+
+    // Write back the dirty frames through the ring, as many at once as it holds. Compressed
+    // pages are written from buffers of their own, the ring waits for their writes once they
+    // are all taken. Called with the latch held exclusively.
+    void writeFrames(const std::vector<std::pair<uint32_t, uint32_t>>& dirty) {
+        std::vector<uint64_t> failed;
+        std::unique_ptr<unsigned char, decltype(&std::free)> packed(nullptr, &std::free);
+        if (_page_compression.load(std::memory_order_relaxed) == PageCompression::All) {
+            packed.reset(static_cast<unsigned char*>(std::aligned_alloc(PageSize, (size_t)PageRingEntries * PageSize)));
+            if (!packed)
+                throw std::runtime_error("Failed to allocate the compression buffers");
+        }
+        {
+            std::lock_guard<std::mutex> ringLock(_ringMutex);
+            auto opcode = _fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            uint32_t packedCount = 0;
+            for (auto [pid, frame] : dirty) {
+                auto page = _ptr + (size_t)frame * PageSize;
+                setPageChecksum(page);
+                if (packedCount == PageRingEntries) {
+                    while (_writes_in_flight > 0)
+                        drainRing(1, &failed);
+                    packedCount = 0;
+                }
+                auto size = packed ? packPage(page, packed.get() + (size_t)packedCount * PageSize, false) : PageSize;
+                if (size == PageSize) {
+                    while (!_ring.prepare(opcode, _fd, page, PageSize, (uint64_t)pid * PageSize, PageRingWriteTag, bufferIndex(frame)))
+                        drainRing(1, &failed);
+                } else {
+                    while (!_ring.prepare(IORING_OP_WRITE, _fd, packed.get() + (size_t)packedCount * PageSize, (uint32_t)size, (uint64_t)pid * PageSize, PageRingPackedWriteTag, -1))
+                        drainRing(1, &failed);
+                    packedCount++;
+                    punchPage(pid, size);
+                }
+                _writes_in_flight++;
+                _frames[frame]._dirty.store(false, std::memory_order_relaxed);
+                growFile(pid + 1);
+            }
+            while (_writes_in_flight > 0)
+                drainRing(1, &failed);
+        }
+        dropFailedReads(failed);
+
+        if (_write_error != 0) {
+            auto error = std::exchange(_write_error, 0);
+            throw std::runtime_error(std::string("Failed to write pages: ") + std::strerror(error));
+        }
+    }
+
+    // Pin frame if it still holds pid and the CLOCK sweep isn't replacing it
+    bool tryPin(uint32_t frame, uint32_t pid) {
+        auto& current = _frames[frame];
+        auto pins = current._pins.fetch_add(1, std::memory_order_acquire);
+        if ((pins & EvictingPin) == 0 && current._pid.load(std::memory_order_acquire) == pid)
+            return true;
+        current._pins.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+
+    // Count an access to frame for the CLOCK sweep. A point access takes a scan page out of
+    // the scan ring, accesses of scans leave frames as they are.
+    void touch(uint32_t frame) {
+        if (ThreadPins._scanning)
+            return;
+        auto& current = _frames[frame];
+        current._referenced.store(true, std::memory_order_relaxed);
+        if (current._scan.load(std::memory_order_relaxed))
+            current._scan.store(false, std::memory_order_relaxed);
+    }
+
+    // Called with the latch held exclusively
+    void enterScanRing(uint32_t frame) {
+        _frames[frame]._scan.store(true, std::memory_order_relaxed);
+        _frames[frame]._referenced.store(false, std::memory_order_relaxed);
+        _scanFrames.push_back(frame);
+    }
+
+    // Keep the pin of a fixed frame until the Scope ends, or drop it right away when the thread
+    // has no Scope open. An unscoped pin is left to the caller.
+    void hold(uint32_t frame, bool scoped) {
+        touch(frame);
+        if (!scoped)
+            return;
+        if (ThreadPins._depth > 0)
+            ThreadPins._frames.push_back(frame);
+        else
+            _frames[frame]._pins.fetch_sub(1, std::memory_order_release);
+    }
+
+    // End the outermost Scope of the thread. The pages it allocated are logged before they are
+    // unpinned, then the thread waits for its records to be durable.
+    void endScope() {
+        if (ThreadPins._writing && _wal.isOpen())
+            logNewPages();
+        unpinAll();
+        auto lsn = std::exchange(ThreadWrites._lsn, 0);
+        // a Scope left by an exception has nothing to commit
+        if (lsn > 0 && std::uncaught_exceptions() == 0)
+            _wal.flush(lsn);
+    }
+
+    void unpinAll() {
+        for (auto frame : ThreadPins._frames) {
+            // dirty is visible to the CLOCK sweep once it sees the pin released
+            if (ThreadPins._writing)
+                _frames[frame]._dirty.store(true, std::memory_order_relaxed);
+            _frames[frame]._pins.fetch_sub(1, std::memory_order_release);
+        }
+        ThreadPins._frames.clear();
+        ThreadPins._writing = false;
+        ThreadPins._scanning = false;
+    }
+
+    // Empty a frame for another page and return it with EvictingPin set. Once scans fill the
+    // scan ring they recycle its frames oldest first, and pages of point lookups are only
+    // evicted by them while the ring grows. Otherwise the CLOCK hand passes over pinned frames
+    // and gives frames with the referenced bit set a second chance. Returns UINT32_MAX when
+    // every frame is pinned and mayThrow is not set. Called with the latch held exclusively.
+    uint32_t evict(bool mayThrow = true) {
+        if (_scanFrames.size() >= std::min(ScanRingFrames, _frame_count / 4)) {
+            for (auto tries = _scanFrames.size(); tries > 0 && !_scanFrames.empty(); tries--) {
+                auto frame = _scanFrames.front();
+                _scanFrames.pop_front();
+                // a point access or the CLOCK sweep took the frame out of the ring since
+                if (!_frames[frame]._scan.load(std::memory_order_relaxed))
+                    continue;
+                uint32_t unpinned = 0;
+                if (!_frames[frame]._pins.compare_exchange_strong(unpinned, EvictingPin, std::memory_order_acquire)) {
+                    _scanFrames.push_back(frame);
+                    continue;
+                }
+                vacate(frame);
+                return frame;
+            }
+        }
+
+        for (size_t step = 0; step <= 2 * (size_t)_frame_count; step++) {
+            auto frame = _clock_hand;
+            _clock_hand = (_clock_hand + 1) % _frame_count;
+            auto& current = _frames[frame];
+            auto pid = current._pid.load(std::memory_order_relaxed);
+            if (current._pins.load(std::memory_order_relaxed) > 0)
+                continue;
+            if (pid != UINT32_MAX && current._referenced.exchange(false, std::memory_order_relaxed))
+                continue;
+            // claiming the frame fails while a reader holds it, even one that found it latch free
+            uint32_t unpinned = 0;
+            if (!current._pins.compare_exchange_strong(unpinned, EvictingPin, std::memory_order_acquire))
+                continue;
+            if (pid != UINT32_MAX)
+                vacate(frame);
+            return frame;
+        }
+
+        if (!mayThrow)
+            return UINT32_MAX;
+        throw std::runtime_error("All buffer frames are pinned");
+    }
+
+    // Write back and drop the page of a frame claimed for eviction
+    void vacate(uint32_t frame) {
+        auto& current = _frames[frame];
+        if (current._dirty.load(std::memory_order_relaxed))
+            writeFrame(frame, true);
+        _pageTable.erase(current._pid.load(std::memory_order_relaxed));
+        current._pid.store(UINT32_MAX, std::memory_order_release);
+        current._scan.store(false, std::memory_order_relaxed);
+    }
+
+    // Write back the page of frame, evicted when the frame is being vacated
+    void writeFrame(uint32_t frame, bool evicted = false) {
+        auto pid = _frames[frame]._pid.load(std::memory_order_relaxed);
+        auto page = _ptr + (size_t)frame * PageSize;
+        // the log holds the changes of a page before the page is written
+        if (_wal.isOpen())
+            _wal.flush(getPageLsn(page));
+        setPageChecksum(page);
+        writePage(pid, page, evicted);
+        _frames[frame]._dirty.store(false, std::memory_order_relaxed);
+        growFile(pid + 1);
+    }
+
+    // Read count pages at pid into buffer. The last page of the file reads as zeroes past its end
+    // when it is compressed.
+    void readPages(uint32_t pid, uint32_t count, unsigned char* buffer) {
+        auto size = (size_t)count * PageSize;
+        auto read = pread(_fd, buffer, size, (off_t)pid * PageSize);
+        if (read < 0)
+            throw std::runtime_error(std::string("Failed to read pages: ") + std::strerror(errno));
+        std::memset(buffer + read, 0, size - (size_t)read);
+    }
+
+    void writePages(uint32_t pid, uint32_t count, const unsigned char* buffer) {
+        auto size = (size_t)count * PageSize;
+        if (pwrite(_fd, buffer, size, (off_t)pid * PageSize) != (ssize_t)size)
+            throw std::runtime_error(std::string("Failed to write pages: ") + std::strerror(errno));
+    }
+
+    // CRC32C of page with its checksum taken as zero
+    static uint32_t getPageChecksum(const unsigned char* page) {
+        uint32_t zero = 0;
+        auto crc = Crc32c(page, PageChecksumOffset);
+        crc = Crc32c(&zero, sizeof(zero), crc);
+        return Crc32c(page + PageChecksumOffset + sizeof(zero), PageSize - PageChecksumOffset - sizeof(zero), crc);
+    }
+
+    static void setPageChecksum(unsigned char* page) {
+        auto crc = getPageChecksum(page);
+        std::memcpy(page + PageChecksumOffset, &crc, sizeof(crc));
+    }
+
+    // Write page to its slot in the file, compressed when the compression mode covers the
+    // write-back, evicted or not, and that saves a block
+    void writePage(uint32_t pid, const unsigned char* page, bool evicted) {
+        alignas(PageSize) static thread_local unsigned char packed[PageSize];
+        auto size = packPage(page, packed, evicted);
+        if (size == PageSize) {
+            writePages(pid, 1, page);
+            return;
+        }
+        if (pwrite(_fd, packed, size, (off_t)pid * PageSize) != (ssize_t)size)
+            throw std::runtime_error(std::string("Failed to write pages: ") + std::strerror(errno));
+        punchPage(pid, size);
+    }
+
+    // Compress page into packed when the compression mode covers its write-back. Returns the bytes
+    // of packed to write, whole blocks, or PageSize when the page is to be written as it is.
+    size_t packPage(const unsigned char* page, unsigned char* packed, bool evicted) {
+        auto mode = _page_compression.load(std::memory_order_relaxed);
+        if (mode == PageCompression::Off || (mode == PageCompression::Evicted && !evicted))
+            return PageSize;
+        auto capacity = PageSize - PackedPageBlockSize - sizeof(BufferPackedPage);
+        auto size = LzCompress(page, PageSize, packed + sizeof(BufferPackedPage), capacity);
+        if (size == 0)
+            return PageSize;
+
+        BufferPackedPage header{PackedPageMagic, (uint32_t)size};
+        std::memcpy(packed, &header, sizeof(header));
+        size += sizeof(header);
+        auto blocks = (size + PackedPageBlockSize - 1) / PackedPageBlockSize * PackedPageBlockSize;
+        std::memset(packed + size, 0, blocks - size);
+        _packed_pages.fetch_add(1, std::memory_order_relaxed);
+        return blocks;
+    }
+
+    // Free the blocks of the slot of pid past the written bytes of its compressed page. File
+    // systems without holes keep them, they are never read.
+    void punchPage(uint32_t pid, size_t written) {
+        fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)pid * PageSize + (off_t)written, (off_t)(PageSize - written));
+    }
+
+    // Whether page, just read on the path read, is intact or goes unchecked on that path. A
+    // compressed page is decompressed in place first, it is damaged when that fails.
+    bool loadPage(unsigned char* page, uint32_t read) {
+        BufferPackedPage header;
+        std::memcpy(&header, page, sizeof(header));
+        if (header._magic == PackedPageMagic) {
+            alignas(PageSize) static thread_local unsigned char packed[PageSize];
+            if (header._size > PageSize - sizeof(header)) {
+                _checksum_failures.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::memcpy(packed, page + sizeof(header), header._size);
+            if (!LzDecompress(packed, header._size, page, PageSize)) {
+                _checksum_failures.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        return checkPage(page, read);
+    }
+
+    // Whether page, just read on the path read, is intact or goes unchecked on that path
+    bool checkPage(const unsigned char* page, uint32_t read) {
+        if ((_checksum_reads.load(std::memory_order_relaxed) & read) == 0)
+            return true;
+        uint32_t crc;
+        std::memcpy(&crc, page + PageChecksumOffset, sizeof(crc));
+        if (crc == getPageChecksum(page))
+            return true;
+        // pages that were never written back read as zeroes
+        if (page[0] == 0 && std::memcmp(page, page + 1, PageSize - 1) == 0)
+            return true;
+        _checksum_failures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void growFile(uint32_t pages) {
+        auto current = _file_pages.load(std::memory_order_relaxed);
+        while (current < pages && !_file_pages.compare_exchange_weak(current, pages, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint32_t frameOf(const unsigned char* page) { return (uint32_t)((page - _ptr) / PageSize); }
+
+    static uint64_t getPageLsn(unsigned char* page) {
+        return std::atomic_ref<uint64_t>(*reinterpret_cast<uint64_t*>(page + PageLsnOffset)).load(std::memory_order_relaxed);
+    }
+
+    // Raise the LSN of page to lsn. A latched writer and write() may log the page at once.
+    static void setPageLsn(unsigned char* page, uint64_t lsn) {
+        std::atomic_ref<uint64_t> pageLsn(*reinterpret_cast<uint64_t*>(page + PageLsnOffset));
+        auto current = pageLsn.load(std::memory_order_relaxed);
+        while (current < lsn && !pageLsn.compare_exchange_weak(current, lsn, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Remember the record to wait for at the end of the Scope, or wait now without one
+    void noteRecord(uint64_t lsn) {
+        if (ThreadPins._depth > 0)
+            ThreadWrites._lsn = std::max(ThreadWrites._lsn, lsn);
+        else
+            _wal.flush(lsn);
+    }
+
+    // Log the pages the thread allocated whole
+    void logNewPages() {
+        for (auto frame : ThreadWrites._newFrames) {
+            auto page = _ptr + (size_t)frame * PageSize;
+            auto pid = _frames[frame]._pid.load(std::memory_order_relaxed);
+            auto lsn = _wal.append(WalRecordType::PageImage, pid, getImage(page));
+            setPageLsn(page, lsn);
+            _frames[frame]._dirty.store(true, std::memory_order_relaxed);
+            noteRecord(lsn);
+        }
+        ThreadWrites._newFrames.clear();
+    }
+
+    // The page as it is logged whole
+    std::span<const unsigned char> getImage(const unsigned char* page) {
+        auto& record = ThreadWrites._record;
+        record.assign(page, page + PageSize);
+        std::memset(record.data() + PageVersionOffset, 0, sizeof(uint32_t));
+        return record;
+    }
+
+    // Log the runs of bytes the page in frame differs from before in, or the whole page when
+    // the runs would take more than half of it
+    void logChanges(uint32_t frame, const unsigned char* before) {
+        auto page = _ptr + (size_t)frame * PageSize;
+        auto& record = ThreadWrites._record;
+        record.clear();
+        for (uint32_t i = 0; i < PageSize; i += sizeof(uint64_t)) {
+            if (std::memcmp(page + i, before + i, sizeof(uint64_t)) == 0)
+                continue;
+            // runs end after two equal words, shorter gaps cost less than another run header
+            auto end = i + (uint32_t)sizeof(uint64_t);
+            for (auto next = end; next < PageSize && next < end + 2 * sizeof(uint64_t); next += sizeof(uint64_t))
+                if (std::memcmp(page + next, before + next, sizeof(uint64_t)) != 0)
+                    end = next + sizeof(uint64_t);
+            appendRun(record, page, i, end - i);
+            i = end - sizeof(uint64_t);
+        }
+        if (record.empty())
+            return;
+
+        auto pid = _frames[frame]._pid.load(std::memory_order_relaxed);
+        auto lsn = record.size() > PageSize / 2 ? _wal.append(WalRecordType::PageImage, pid, getImage(page))
+            : _wal.append(WalRecordType::PageDelta, pid, record);
+        setPageLsn(page, lsn);
+        // a checkpoint that copied the page before the change writes it again
+        _frames[frame]._dirty.store(true, std::memory_order_relaxed);
+        noteRecord(lsn);
+    }
+
+    static void appendRun(std::vector<unsigned char>& record, const unsigned char* page, uint32_t offset, uint32_t length) {
+        uint16_t run[2] = {(uint16_t)offset, (uint16_t)length};
+        record.insert(record.end(), reinterpret_cast<unsigned char*>(run), reinterpret_cast<unsigned char*>(run) + sizeof(run));
+        auto bytes = record.size();
+        record.insert(record.end(), page + offset, page + offset + length);
+        for (auto i = std::max(offset, PageVersionOffset); i < std::min(offset + length, PageVersionOffset + (uint32_t)sizeof(uint32_t)); i++)
+            record[bytes + i - offset] = 0;
+    }
+
+    static void applyRuns(unsigned char* page, const unsigned char* runs, uint32_t size) {
+        for (uint32_t pos = 0; pos + 2 * sizeof(uint16_t) <= size;) {
+            uint16_t run[2];
+            std::memcpy(run, runs + pos, sizeof(run));
+            pos += sizeof(run);
+            std::memcpy(page + run[0], runs + pos, run[1]);
+            pos += run[1];
+        }
+    }
+
+    // Wait for duration or until the checkpointer is stopped. Returns false once it is.
+    bool pause(std::chrono::microseconds duration) {
+        std::unique_lock<std::mutex> lock(_checkpointerMutex);
+        return !_checkpointerWake.wait_for(lock, duration, [this]() { return _checkpointer_stop; });
+    }
+
+    // Checkpoint when the log grew by logBytes since the last checkpoint, writing pagesPerTick
+    // pages every CheckpointTick or as fast as it can when it is 0. Gives up when the
+    // checkpointer is stopped or flush() takes over.
+    void runCheckpoint(uint32_t pagesPerTick, uint64_t logBytes) {
+        std::lock_guard<std::mutex> checkpointLock(_checkpointMutex);
+        if (!_wal.isOpen())
+            throw std::runtime_error("Buffer cache is not durable");
+        // every change logged before begin is in a page that is dirty or latched by now
+        auto begin = _wal.getEndLsn();
+        if (begin < _checkpoint_lsn + logBytes)
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+        auto batchPages = std::max(1u, std::min(CheckpointBatchPages, _frame_count / 8));
+        std::unique_ptr<unsigned char, decltype(&std::free)> copies(static_cast<unsigned char*>(std::aligned_alloc(PageSize, (size_t)batchPages * PageSize)), &std::free);
+        if (!copies)
+            throw std::runtime_error("Failed to allocate the checkpoint buffer");
+        std::vector<uint32_t> frames(_frame_count);
+        for (uint32_t frame = 0; frame < _frame_count; frame++)
+            frames[frame] = frame;
+        std::vector<uint32_t> batch;
+        std::vector<uint32_t> busy;
+        uint64_t pages = 0;
+        uint32_t tickPages = 0;
+        while (!frames.empty()) {
+            for (size_t i = 0; i < frames.size();) {
+                batch.clear();
+                for (; i < frames.size() && batch.size() < batchPages; i++) {
+                    auto copied = copyFrame(frames[i], copies.get() + batch.size() * PageSize);
+                    if (copied < 0)
+                        busy.push_back(frames[i]);
+                    else if (copied > 0)
+                        batch.push_back(frames[i]);
+                }
+                writeCopies(batch, copies.get());
+                pages += batch.size();
+                tickPages += (uint32_t)batch.size();
+                if (_checkpoint_yield)
+                    return;
+                if (pagesPerTick > 0 && tickPages >= pagesPerTick) {
+                    tickPages = 0;
+                    if (!pause(CheckpointTick))
+                        return;
+                }
+            }
+            // latched pages are let go of soon
+            if (!busy.empty() && !pause(std::chrono::microseconds(100)))
+                return;
+            frames.swap(busy);
+            busy.clear();
+        }
+
+        _checkpoint_lsn = begin;
+        writeSuperblock();
+        _wal.truncateBefore(begin);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        _checkpoint_pages += pages;
+        _checkpoint_page_rate = (uint64_t)(pages / std::max(seconds, 1e-6));
+        _checkpoints++;
+    }
+
+    // Copy the page in frame to copy when it changed since it was last written and keep the
+    // frame pinned for writeCopies(). Returns 1 once copied, 0 when there is nothing to write
+    // and -1 when a writer is changing the page.
+    int copyFrame(uint32_t frame, unsigned char* copy) {
+        auto& current = _frames[frame];
+        auto pid = current._pid.load(std::memory_order_acquire);
+        // a page evicted since was written back then
+        if (pid == UINT32_MAX || isLoading(frame) || !tryPin(frame, pid))
+            return 0;
+
+        auto page = _ptr + (size_t)frame * PageSize;
+        std::atomic_ref<uint32_t> version(*reinterpret_cast<uint32_t*>(page + PageVersionOffset));
+        auto before = version.load(std::memory_order_acquire);
+        auto copied = -1;
+        if ((before & PageLatchedBit) == 0 && current._writers.load() == 0) {
+            copied = 0;
+            // a change after this marks the page dirty again
+            if (current._dirty.exchange(false)) {
+                std::memcpy(copy, page, PageSize);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                copied = 1;
+                if (version.load(std::memory_order_relaxed) != before || current._writers.load(std::memory_order_relaxed) > 0) {
+                    current._dirty.store(true, std::memory_order_relaxed);
+                    copied = -1;
+                }
+            }
+        }
+        if (copied != 1)
+            current._pins.fetch_sub(1, std::memory_order_release);
+        return copied;
+    }
+
+    // Write the copies of the pages in frames once the log holds what they have, and unpin
+    // the frames. They stay pinned until then, so the CLOCK sweep can't write a newer page first.
+    void writeCopies(const std::vector<uint32_t>& frames, unsigned char* copies) {
+        if (frames.empty())
+            return;
+
+        size_t written = 0;
+        try {
+            // a write() may have changed a copy before its record got its LSN into the page
+            _wal.flush(_wal.getEndLsn());
+            for (; written < frames.size(); written++) {
+                auto pid = _frames[frames[written]]._pid.load(std::memory_order_relaxed);
+                setPageChecksum(copies + written * PageSize);
+                writePage(pid, copies + written * PageSize, false);
+                growFile(pid + 1);
+            }
+        } catch (...) {
+            for (auto i = written; i < frames.size(); i++)
+                _frames[frames[i]]._dirty.store(true, std::memory_order_relaxed);
+            for (auto frame : frames)
+                _frames[frame]._pins.fetch_sub(1, std::memory_order_release);
+            throw;
+        }
+        for (auto frame : frames)
+            _frames[frame]._pins.fetch_sub(1, std::memory_order_release);
+    }
+
+    // Redo the records of the log on the pages they are newer than, follow the pages they
+    // allocate and free in the free list, then checkpoint
+    void recover() {
+        _wal.open(_log_path, _log_lsn);
+        auto pids = collectFreePages();
+        std::set<uint32_t> freePages(pids.begin(), pids.end());
+        uint64_t records = 0;
+        _wal.replay([&](const WalRecordHeader& record, const unsigned char* payload) {
+            records++;
+            auto type = (WalRecordType)record._type;
+            if (type == WalRecordType::FreePage) {
+                freePages.insert(record._pid);
+                return;
+            }
+            if (type == WalRecordType::RootPid) {
+                _root_pid = record._pid;
+                return;
+            }
+
+            freePages.erase(record._pid);
+            _next_free_page = std::max(_next_free_page.load(), record._pid + 1);
+            auto frame = fix(record._pid, false, false);
+            auto page = _ptr + (size_t)frame * PageSize;
+            if (getPageLsn(page) < record._lsn) {
+                if (type == WalRecordType::PageImage)
+                    std::memcpy(page, payload, PageSize);
+                else
+                    applyRuns(page, payload, record._payload_size);
+                setPageLsn(page, record._lsn);
+                _frames[frame]._dirty.store(true, std::memory_order_relaxed);
+            }
+            _frames[frame]._pins.fetch_sub(1, std::memory_order_release);
+        }, _checkpoint_lsn);
+
+        clearFreeLists();
+        dealFreePages(std::vector<uint32_t>(freePages.begin(), freePages.end()));
+        if (records > 0)
+            flush();
+    }
+
+    // Deal free PIDs out to the cores evenly
+    void dealFreePages(const std::vector<uint32_t>& freePages) {
+        for (size_t i = 0; i < freePages.size(); i++)
+            _shards[i % _shard_count]._freePids.push_back(freePages[i]);
+        for (uint32_t i = 0; i < _shard_count; i++)
+            _shards[i]._free_count = _shards[i]._freePids.size();
+    }
+
+    // Read the superblock and the free list
+    void load() {
+        alignas(PageSize) unsigned char scratch[PageSize];
+        auto superblock = reinterpret_cast<BufferCacheSuperblock*>(scratch);
+        readPages(0, 1, scratch);
+        if (superblock->_magic != BufferCacheMagic || superblock->_page_size != PageSize)
+            throw std::runtime_error("File is not a buffer cache file of this page size");
+
+        _next_free_page = superblock->_next_free_page;
+        _root_pid = superblock->_root_pid;
+        _checkpoint_lsn = superblock->_checkpoint_lsn;
+        _log_lsn = superblock->_log_lsn;
+        auto pids = reinterpret_cast<uint32_t*>(superblock + 1);
+        std::vector<uint32_t> freePages(pids, pids + superblock->_free_count);
+
+        auto trunk = reinterpret_cast<BufferCacheFreeTrunk*>(scratch);
+        _trunk_pids.clear();
+        for (auto pid = superblock->_free_trunk_pid; pid != UINT32_MAX; pid = trunk->_next_pid) {
+            readPages(pid, 1, scratch);
+            _trunk_pids.push_back(pid);
+            pids = reinterpret_cast<uint32_t*>(trunk + 1);
+            freePages.insert(freePages.end(), pids, pids + trunk->_count);
+        }
+        dealFreePages(freePages);
+    }
+
+    // Write the free list and then the superblock, and sync the file. The pages written before
+    // are synced first, so the superblock never refers to a page that is not there.
+    void writeSuperblock() {
+        if (fdatasync(_fd) != 0)
+            throw std::runtime_error(std::string("Failed to sync the buffer cache file: ") + std::strerror(errno));
+
+        alignas(PageSize) unsigned char superblockPage[PageSize];
+        auto superblock = reinterpret_cast<BufferCacheSuperblock*>(superblockPage);
+        // the trunk pages of the last superblock are free once this one replaces it
+        auto freePages = collectFreePages();
+        freePages.insert(freePages.end(), _trunk_pids.begin(), _trunk_pids.end());
+        auto trunkCount = (uint32_t)((std::max(freePages.size(), (size_t)SuperblockFreeCapacity) - SuperblockFreeCapacity + TrunkFreeCapacity - 1) / TrunkFreeCapacity);
+        // pages allocated meanwhile come after the trunk pages
+        auto trunkPid = _next_free_page.fetch_add(trunkCount);
+        std::memset(superblock, 0, PageSize);
+        superblock->_magic = BufferCacheMagic;
+        superblock->_page_size = PageSize;
+        superblock->_next_free_page = trunkPid + trunkCount;
+        superblock->_root_pid = _root_pid;
+        superblock->_checkpoint_lsn = _checkpoint_lsn;
+        superblock->_log_lsn = _log_lsn;
+        superblock->_free_count = std::min((size_t)SuperblockFreeCapacity, freePages.size());
+        superblock->_free_trunk_pid = UINT32_MAX;
+        // an empty free list has no data() to copy from
+        if (superblock->_free_count > 0)
+            std::memcpy(superblock + 1, freePages.data(), superblock->_free_count * sizeof(uint32_t));
+
+        // the remaining pids go to trunk pages after the last page in use
+        alignas(PageSize) unsigned char scratch[PageSize];
+        auto trunk = reinterpret_cast<BufferCacheFreeTrunk*>(scratch);
+        size_t next = superblock->_free_count;
+        auto pid = trunkPid;
+        if (next < freePages.size())
+            superblock->_free_trunk_pid = pid;
+        for (; next < freePages.size(); pid++) {
+            std::memset(scratch, 0, PageSize);
+            trunk->_count = std::min((size_t)TrunkFreeCapacity, freePages.size() - next);
+            if (trunk->_count > 0)
+                std::memcpy(trunk + 1, freePages.data() + next, trunk->_count * sizeof(uint32_t));
+            next += trunk->_count;
+            trunk->_next_pid = next < freePages.size() ? pid + 1 : UINT32_MAX;
+            writePages(pid, 1, scratch);
+        }
+
+        writePages(0, 1, superblockPage);
+        growFile(std::max(1u, pid));
+        if (fdatasync(_fd) != 0)
+            throw std::runtime_error(std::string("Failed to sync the buffer cache file: ") + std::strerror(errno));
+
+        // the old trunk pages are recycled as zeroed pages, their content is no page's, and the
+        // new ones stay in use until the next superblock
+        std::memset(scratch, 0, PageSize);
+        for (auto trunk : _trunk_pids)
+            writePages(trunk, 1, scratch);
+        auto& shard = localShard();
+        {
+            std::lock_guard<std::mutex> lock(shard._mutex);
+            shard._freePids.insert(shard._freePids.end(), _trunk_pids.begin(), _trunk_pids.end());
+            shard._free_count.store(shard._freePids.size(), std::memory_order_relaxed);
+        }
+        _trunk_pids.clear();
+        for (auto trunk = trunkPid; trunk < trunkPid + trunkCount; trunk++)
+            _trunk_pids.push_back(trunk);
+    }
+
     uint32_t _pages;
-    uint32_t _next_free_page;
-    std::vector<uint32_t> _freeList;
+    std::atomic<uint32_t> _next_free_page;
+    std::atomic<uint32_t> _root_pid;
+    // Free list pages of the superblock in the file
+    std::vector<uint32_t> _trunk_pids;
+    std::unique_ptr<BufferCacheShard[]> _shards;
+    uint32_t _shard_count;
     unsigned char* _ptr;
+    size_t _arena_size;
+    ArenaBacking _arena_backing;
+    uint32_t _arena_nodes;
+    int _fd;
+    // Taken to bring a page into a frame, and by open, flush and close
     std::shared_mutex _rwMutex;
+
+    // File backed mode
+    std::unique_ptr<BufferFrame[]> _frames;
+    uint32_t _frame_count;
+    uint32_t _clock_hand;
+    // Pages the file holds, a checkpoint grows it without the latch
+    std::atomic<uint32_t> _file_pages;
+    BufferPageTable _pageTable;
+    std::atomic<uint64_t> _misses;
+
+    // Page checksums
+    std::atomic<uint32_t> _checksum_reads = ChecksumAllReads;
+    std::atomic<uint64_t> _checksum_failures = 0;
+
+    // Page compression
+    std::atomic<PageCompression> _page_compression = PageCompression::Off;
+    std::atomic<uint64_t> _packed_pages = 0;
+
+    // Asynchronous I/O, _ringMutex is taken after _rwMutex
+    IoRing _ring;
+    bool _fixed_buffers = false;
+    std::mutex _ringMutex;
+    uint32_t _reads_in_flight;
+    std::atomic<uint64_t> _read_aheads = 0;
+    uint32_t _writes_in_flight = 0;
+    int _write_error = 0;
+    // Fetches waiting for a read another fetch started, under _rwMutex
+    std::vector<PageFetch*> _waitingFetches;
+    // Fetches poll() resumes next, under _ringMutex
+    std::vector<PageFetch*> _readyFetches;
+
+    // Frames holding pages of scans in the order they came in, under _rwMutex. Frames that
+    // left the ring are dropped when they come up.
+    std::deque<uint32_t> _scanFrames;
+
+    // Durability
+    WriteAheadLog _wal;
+    std::string _log_path;
+    // Of the superblock, under _checkpointMutex once the cache is open
+    uint64_t _checkpoint_lsn = 0;
+    uint64_t _log_lsn = 0;
+
+    // Checkpoints, _checkpointMutex is taken before _rwMutex
+    std::mutex _checkpointMutex;
+    std::atomic<bool> _checkpoint_yield = false;
+    std::atomic<uint64_t> _checkpoints = 0;
+    std::atomic<uint64_t> _checkpoint_pages = 0;
+    std::atomic<uint64_t> _checkpoint_page_rate = 0;
+    std::thread _checkpointer;
+    std::mutex _checkpointerMutex;
+    std::condition_variable _checkpointerWake;
+    bool _checkpointer_stop = false;
+    std::exception_ptr _checkpointer_error;
 };
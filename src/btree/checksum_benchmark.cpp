@@ -0,0 +1,40 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "crc32c.h"
+
+// 64MB of pages, more than the CPU caches hold, so the kernel streams from memory like it does
+// over pages just read from the file
+const size_t PageBytes = 8 * 1024;
+const size_t PageCount = 8 * 1024;
+
+// Checksum the first count pages rounds times and print the GB/s and the nanoseconds per page
+static void run(const char* name, const std::vector<unsigned char>& pages, size_t count, bool hardware, int rounds) {
+    uint32_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+        for (size_t page = 0; page < count; page++)
+            sum += Crc32c(pages.data() + page * PageBytes, PageBytes, 0, hardware);
+    auto end = std::chrono::steady_clock::now();
+    auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<name<<" crc32c GB/s is:"<<(double)PageBytes * count * rounds / nano_seconds
+        <<", nanoseconds per page:"<<nano_seconds / (count * rounds)<<", checksum:"<<sum<<"\n";
+}
+
+int main(int argc, const char * argv[]) {
+    std::vector<unsigned char> pages(PageBytes * PageCount);
+    std::mt19937_64 generator(42);
+    for (auto& byte : pages)
+        byte = (unsigned char)generator();
+
+    std::cout<<"hardware crc32c:"<<HasHardwareCrc32c()<<"\n";
+    // a page in the CPU caches shows what the kernel itself does
+    if (HasHardwareCrc32c()) {
+        run("hardware cached page", pages, 1, true, 200 * 1000);
+        run("hardware streaming", pages, PageCount, true, 20);
+    }
+    run("software cached page", pages, 1, false, 10 * 1000);
+    run("software streaming", pages, PageCount, false, 2);
+    return 0;
+}
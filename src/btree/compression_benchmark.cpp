@@ -0,0 +1,124 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+BufferCache BufferCacheInstance(64 * 1024);
+
+const int32_t KeyCount = 200 * 1000;
+const uint32_t CacheFrames = 1024;
+const int LookupCount = 200 * 1000;
+// Rounds of updates of a few hot leaves, each written back by a flush
+const int HotRounds = 200;
+const int32_t HotKeys = 200;
+
+// Records of an archive table, the string heavy rows that sit cold in their leaves
+static std::string valueOf(int32_t key) {
+    return "{\"name\":\"customer " + std::to_string(key) + "\",\"city\":\"Seattle\",\"status\":\"" +
+        (key % 3 == 0 ? "active" : "archived") + "\",\"tier\":" + std::to_string(key % 5) + "}";
+}
+
+// Bytes the file takes on disk
+static size_t allocatedBytes(const std::string& path) {
+    struct stat status;
+    if (::stat(path.c_str(), &status) != 0)
+        return 0;
+    return (size_t)status.st_blocks * 512;
+}
+
+static double perSecond(uint64_t count, std::chrono::steady_clock::time_point start) {
+    auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return count * 1e9 / nano_seconds;
+}
+
+// Build the table into path with the given page compression through a cache much smaller than
+// the table, so most pages are evicted, then keep updating a few hot leaves and flush after
+// each round. Then look up random keys, so most lookups read a leaf from the file.
+static void run(const std::string& path, PageCompression mode, const char* name) {
+    std::filesystem::remove(path);
+    BufferCacheInstance.open(path, CacheFrames);
+    BufferCacheInstance.setPageCompression(mode);
+    auto packed = BufferCacheInstance.getPackedPageCount();
+    double inserts, flushes;
+    uint64_t hotPacked;
+    {
+        BTree<int32_t, std::string> tree;
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t key = 0; key < KeyCount; key++)
+            tree.insert(key, valueOf(key));
+        inserts = perSecond(KeyCount, start);
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+
+        hotPacked = BufferCacheInstance.getPackedPageCount();
+        start = std::chrono::steady_clock::now();
+        for (auto round = 0; round < HotRounds; round++) {
+            for (int32_t key = 0; key < HotKeys; key++)
+                tree.upsert(key, valueOf(key + round % 2));
+            BufferCacheInstance.flush();
+        }
+        flushes = perSecond(HotRounds, start);
+        hotPacked = BufferCacheInstance.getPackedPageCount() - hotPacked;
+    }
+    BufferCacheInstance.close();
+    auto bytes = allocatedBytes(path);
+    packed = BufferCacheInstance.getPackedPageCount() - packed;
+
+    BufferCacheInstance.open(path, CacheFrames);
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int32_t> keys(0, KeyCount - 1);
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        for (auto i = 0; i < LookupCount; i++)
+            found += tree.find(keys(generator)).data.size();
+    }
+    auto lookups = perSecond(LookupCount, start);
+    std::cout<<name<<": inserts per second:"<<(uint64_t)inserts<<", hot update flushes per second:"<<(uint64_t)flushes
+        <<", hot pages written compressed:"<<hotPacked<<", file bytes on disk:"<<bytes
+        <<", pages written compressed:"<<packed
+        <<", hit rate:"<<BufferCacheInstance.getHitRate()
+        <<", cold lookups per second:"<<(uint64_t)lookups<<", bytes found:"<<found<<"\n";
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+}
+
+// Compress and decompress a leaf full of records rounds times and print the MB/s of each
+static void runCodec(int rounds) {
+    std::vector<unsigned char> page(PageSize), compressed(PageSize), restored(PageSize);
+    std::string records;
+    for (int32_t key = 0; records.size() < PageSize; key++)
+        records += valueOf(key);
+    std::memcpy(page.data(), records.data(), PageSize);
+
+    size_t size = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto round = 0; round < rounds; round++)
+        size = LzCompress(page.data(), PageSize, compressed.data(), PageSize);
+    auto middle = std::chrono::steady_clock::now();
+    auto intact = true;
+    for (auto round = 0; round < rounds; round++)
+        intact &= LzDecompress(compressed.data(), size, restored.data(), PageSize);
+    auto end = std::chrono::steady_clock::now();
+    auto compress_nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(middle - start).count();
+    auto decompress_nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle).count();
+    std::cout<<"page compression ratio:"<<(double)PageSize / size
+        <<", compress MB/s:"<<(uint64_t)((double)PageSize * rounds * 1e3 / compress_nano_seconds)
+        <<", decompress MB/s:"<<(uint64_t)((double)PageSize * rounds * 1e3 / decompress_nano_seconds)
+        <<", intact:"<<intact<<"\n";
+}
+
+int main(int argc, const char * argv[]) {
+    runCodec(100 * 1000);
+    auto path = (std::filesystem::temp_directory_path() / "btree_compression_benchmark.db").string();
+    run(path, PageCompression::Off, "uncompressed pages");
+    run(path, PageCompression::Evicted, "evicted pages compressed");
+    run(path, PageCompression::All, "all pages compressed");
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+BufferCache BufferCacheInstance(64 * 1024);
+
+const int64_t KeyCount = 4 * 1000 * 1000;
+
+// Run threads for duration, each doing lookups of loaded keys and insertPercent% inserts of new
+// odd keys into one shared tree. Returns the total operations per second.
+static uint64_t run(BTree<int64_t, int64_t>& tree, int threads, int insertPercent, std::chrono::milliseconds duration) {
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> total = 0;
+    std::vector<std::thread> workers;
+    for (auto t = 0; t < threads; t++)
+        workers.emplace_back([&, t]() {
+            std::mt19937_64 generator(t * 7919 + insertPercent);
+            uint64_t operations = 0;
+            int64_t sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                // check the clock rarely, each batch is a few microseconds
+                for (auto i = 0; i < 256; i++, operations++) {
+                    auto key = (int64_t)(generator() % KeyCount) * 2;
+                    if ((int)(generator() % 100) < insertPercent)
+                        tree.insert(key + 1, key);
+                    else
+                        sum += tree.find(key).data;
+                }
+            }
+            if (sum < 0)
+                std::cout<<"unexpected checksum"<<"\n";
+            total += operations;
+        });
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& worker : workers)
+        worker.join();
+    auto end = std::chrono::steady_clock::now();
+    auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return (uint64_t)(total * 1e9 / nano_seconds);
+}
+
+int main(int argc, const char * argv[]) {
+    auto duration = std::chrono::milliseconds(argc > 1 ? std::atoi(argv[1]) : 1000);
+    int maxThreads = std::max(32u, std::thread::hardware_concurrency());
+
+    std::vector<std::pair<int64_t, int64_t>> items;
+    items.reserve(KeyCount);
+    for (int64_t i = 0; i < KeyCount; i++)
+        items.emplace_back(i * 2, i);
+    BTree<int64_t, int64_t> tree;
+    tree.bulkLoad(items.begin(), items.end());
+
+    std::cout<<"hardware threads:"<<std::thread::hardware_concurrency()<<"\n";
+    for (auto insertPercent : {0, 10, 50}) {
+        uint64_t single = 0;
+        for (auto threads = 1; threads <= maxThreads; threads *= 2) {
+            auto rate = run(tree, threads, insertPercent, duration);
+            if (threads == 1)
+                single = rate;
+            std::cout<<insertPercent<<"% inserts, "<<threads<<" threads: "<<rate<<" ops per second, scaling "
+                <<(double)rate / single<<"x"<<"\n";
+        }
+    }
+
+    return 0;
+}
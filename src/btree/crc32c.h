@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// CRC32C (Castagnoli), the checksum of iSCSI and ext4. The SSE4.2 crc32 instruction computes it
+// 8 bytes at a time, picked at runtime with a table driven fallback. One crc32 takes 3 cycles to
+// feed the next, so the kernel runs three independent CRCs over three stretches of the data and
+// shifts the first two over the bytes after them to combine them.
+
+// Reflected polynomial
+constexpr uint32_t Crc32cPolynomial = 0x82F63B78;
+
+// Bytes of each of the three stretches the kernel interleaves, sized so a page minus its header
+// is one round
+constexpr size_t Crc32cStride = 2688;
+
+// Product of two polynomials modulo the CRC polynomial, bit 31 being x^0
+constexpr uint32_t Crc32cMultiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+        if (a & bit)
+            product ^= b;
+        b = b & 1 ? (b >> 1) ^ Crc32cPolynomial : b >> 1;
+    }
+    return product;
+}
+
+// x^(8 * bytes) modulo the CRC polynomial. Multiplying a CRC by it appends that many zero bytes.
+constexpr uint32_t Crc32cShift(size_t bytes) {
+    uint32_t power = 1u << 31;
+    for (size_t i = 0; i < 8 * bytes; i++)
+        power = power & 1 ? (power >> 1) ^ Crc32cPolynomial : power >> 1;
+    return power;
+}
+
+constexpr uint32_t Crc32cStrideShift = Crc32cShift(Crc32cStride);
+
+struct Crc32cTable {
+    uint32_t _entries[256];
+
+    constexpr Crc32cTable() : _entries() {
+        for (uint32_t i = 0; i < 256; i++) {
+            auto crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = crc & 1 ? (crc >> 1) ^ Crc32cPolynomial : crc >> 1;
+            _entries[i] = crc;
+        }
+    }
+};
+
+inline bool HasHardwareCrc32c() {
+#if defined(__x86_64__)
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    return hardware;
+#else
+    return false;
+#endif
+}
+
+// The CRC register after size bytes at data, without the inversions of the final checksum
+inline uint32_t SoftwareCrc32cUpdate(uint32_t crc, const unsigned char* data, size_t size) {
+    static constexpr Crc32cTable table;
+    for (size_t i = 0; i < size; i++)
+        crc = (crc >> 8) ^ table._entries[(crc ^ data[i]) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t HardwareCrc32cUpdate(uint32_t crc, const unsigned char* data, size_t size) {
+    uint64_t crc0 = crc;
+    for (; size >= 3 * Crc32cStride; size -= 3 * Crc32cStride, data += 3 * Crc32cStride) {
+        uint64_t crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < Crc32cStride; i += sizeof(uint64_t)) {
+            uint64_t word0, word1, word2;
+            std::memcpy(&word0, data + i, sizeof(uint64_t));
+            std::memcpy(&word1, data + Crc32cStride + i, sizeof(uint64_t));
+            std::memcpy(&word2, data + 2 * Crc32cStride + i, sizeof(uint64_t));
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc0 = Crc32cMultiply(Crc32cMultiply((uint32_t)crc0, Crc32cStrideShift) ^ (uint32_t)crc1, Crc32cStrideShift) ^ (uint32_t)crc2;
+    }
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(uint64_t));
+        crc0 = _mm_crc32_u64(crc0, word);
+    }
+    auto crc32 = (uint32_t)crc0;
+    for (; size > 0; size--, data++)
+        crc32 = _mm_crc32_u8(crc32, *data);
+    return crc32;
+}
+#endif
+
+// CRC32C of size bytes at data. Passing the CRC of the bytes before as crc continues it.
+inline uint32_t Crc32c(const void* data, size_t size, uint32_t crc = 0, bool hardware = HasHardwareCrc32c()) {
+    auto bytes = static_cast<const unsigned char*>(data);
+#if defined(__x86_64__)
+    if (hardware)
+        return ~HardwareCrc32cUpdate(~crc, bytes, size);
+#endif
+    return ~SoftwareCrc32cUpdate(~crc, bytes, size);
+}
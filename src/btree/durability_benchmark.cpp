@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+BufferCache BufferCacheInstance(16 * 1024);
+
+const uint32_t CheckpointPagesPerSecond = 50 * 1000;
+
+// Run threads for duration, each inserting its own keys into one shared tree of a durable cache.
+// Every insert returns once its log records are durable. Prints the inserts per second and the
+// inserts committed by each log write.
+static void run(BTree<int64_t, int64_t>& tree, int threads, std::chrono::milliseconds duration) {
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> total = 0;
+    std::vector<std::thread> workers;
+    auto writes = BufferCacheInstance.getLogWriteCount();
+    for (auto t = 0; t < threads; t++)
+        workers.emplace_back([&, t]() {
+            static std::atomic<int64_t> nextKey = 0;
+            uint64_t operations = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto key = nextKey.fetch_add(1, std::memory_order_relaxed);
+                tree.insert(key, key);
+                operations++;
+            }
+            total += operations;
+        });
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& worker : workers)
+        worker.join();
+    auto end = std::chrono::steady_clock::now();
+    writes = BufferCacheInstance.getLogWriteCount() - writes;
+    auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<threads<<" threads: "<<(uint64_t)(total * 1e9 / nano_seconds)<<" durable inserts per second, "
+        <<(double)total / std::max<uint64_t>(writes, 1)<<" inserts per log write"<<"\n";
+}
+
+int main(int argc, const char * argv[]) {
+    auto duration = std::chrono::milliseconds(argc > 1 ? std::atoi(argv[1]) : 1000);
+    auto path = (std::filesystem::temp_directory_path() / "btree_durability_benchmark.db").string();
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + WalFileSuffix);
+    BufferCacheInstance.open(path, 0, true);
+
+    {
+        BTree<int64_t, int64_t> tree;
+        // group commit lets the threads waiting on a log write share the next one
+        for (auto threads = 1; threads <= 16; threads *= 2)
+            run(tree, threads, duration);
+
+        // the checkpointer trickles dirty pages out behind the writers and keeps the log short
+        std::cout<<"dirty ratio before the checkpointer:"<<BufferCacheInstance.getDirtyRatio()<<"\n";
+        BufferCacheInstance.startCheckpointer(CheckpointPagesPerSecond);
+        run(tree, 8, duration);
+        BufferCacheInstance.stopCheckpointer();
+        std::cout<<"checkpoints:"<<BufferCacheInstance.getCheckpointCount()<<", pages written:"<<BufferCacheInstance.getCheckpointPageCount()
+            <<", pages per second:"<<BufferCacheInstance.getCheckpointPageRate()<<", dirty ratio:"<<BufferCacheInstance.getDirtyRatio()<<"\n";
+    }
+
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+// 32MB of frames in front of a file about ten times that size
+BufferCache BufferCacheInstance(4 * 1024);
+
+const int64_t KeyCount = 2 * 1000 * 1000;
+const int64_t LookupCount = 200 * 1000;
+const size_t ValueLength = 100;
+
+// Look up keys drawn by next and print the nanoseconds per lookup and the hit rate
+template<typename Next>
+static void lookup(const char* name, BTree<int64_t, std::string>& tree, Next next, size_t* bytes) {
+    auto hits = BufferCacheInstance.getHitCount();
+    auto misses = BufferCacheInstance.getMissCount();
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < LookupCount; i++)
+        *bytes += tree.find(next()).data.size();
+    auto end = std::chrono::steady_clock::now();
+    hits = BufferCacheInstance.getHitCount() - hits;
+    misses = BufferCacheInstance.getMissCount() - misses;
+    std::cout<<name<<" find in nanoseconds is:"<<std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / LookupCount
+        <<", hit rate:"<<(double)hits / (hits + misses)<<"\n";
+}
+
+// Look up keys drawn by next with up to depth findAsync lookups in flight, so their page reads
+// overlap. Prints the nanoseconds per lookup.
+template<typename Next>
+static void lookupAsync(BTree<int64_t, std::string>& tree, Next next, size_t depth, size_t* bytes) {
+    std::vector<Task<FindResult<std::string>>> tasks;
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < LookupCount; i += depth) {
+        tasks.clear();
+        for (size_t j = 0; j < depth; j++) {
+            tasks.push_back(tree.findAsync(next()));
+            tasks.back().start();
+        }
+        while (std::any_of(tasks.begin(), tasks.end(), [](auto& task) { return !task.done(); }))
+            BufferCacheInstance.poll();
+        for (auto& task : tasks)
+            *bytes += task.result().data.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout<<"uniform findAsync with "<<depth<<" in flight in nanoseconds is:"
+        <<std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / LookupCount<<"\n";
+}
+
+// Scan the whole tree and print the nanoseconds per item, the misses and the pages read ahead
+static void scan(BTree<int64_t, std::string>& tree, size_t* bytes) {
+    auto misses = BufferCacheInstance.getMissCount();
+    auto readAheads = BufferCacheInstance.getReadAheadCount();
+    auto start = std::chrono::steady_clock::now();
+    auto it = tree.cursor();
+    for (auto valid = it.seekFirst(); valid; valid = it.next())
+        *bytes += it.value().size();
+    auto end = std::chrono::steady_clock::now();
+    std::cout<<"scan in nanoseconds per item is:"<<std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / KeyCount
+        <<", misses:"<<BufferCacheInstance.getMissCount() - misses<<", read ahead:"<<BufferCacheInstance.getReadAheadCount() - readAheads<<"\n";
+}
+
+int main(int argc, const char * argv[]) {
+    auto path = (std::filesystem::temp_directory_path() / "btree_eviction_benchmark.db").string();
+    std::filesystem::remove(path);
+    BufferCacheInstance.open(path);
+
+    size_t bytes = 0;
+    {
+        BTree<int64_t, std::string> tree;
+        std::string value(ValueLength, 'v');
+        auto start = std::chrono::steady_clock::now();
+        for (int64_t key = 0; key < KeyCount; key++)
+            tree.insert(key, value);
+        auto end = std::chrono::steady_clock::now();
+        std::cout<<"inserted "<<KeyCount<<" keys in "<<std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()<<" ms, "
+            <<"misses:"<<BufferCacheInstance.getMissCount()<<"\n";
+
+        // uniform lookups touch the whole file, skewed ones mostly stay in a hot range that fits
+        std::mt19937_64 generator(41);
+        auto uniform = [&generator]() { return (int64_t)(generator() % KeyCount); };
+        lookup("uniform", tree, uniform, &bytes);
+        auto skewed = [&generator]() {
+            return (int64_t)(generator() % 100 < 90 ? generator() % (KeyCount / 20) : generator() % KeyCount);
+        };
+        lookup("skewed", tree, skewed, &bytes);
+        // the scan goes through its own frames, the hot range stays cached
+        scan(tree, &bytes);
+        lookup("skewed after scan", tree, skewed, &bytes);
+        if (BufferCacheInstance.isAsync())
+            for (size_t depth : {8, 32})
+                lookupAsync(tree, uniform, depth, &bytes);
+    }
+    std::cout<<"bytes read:"<<bytes<<"\n";
+
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+// 10M int32 keys take ~25k pages after splits and ~12k pages when bulk loaded
+BufferCache BufferCacheInstance(64 * 1024);
+
+const uint32_t KeyCount = 10 * 1000 * 1000;
+
+int main(int argc, const char * argv[]) {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int32_t> distribution(std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max());
+    std::vector<int32_t> keys(KeyCount);
+    for (auto& key : keys)
+        key = distribution(generator);
+
+    auto root = BTreeNode<int32_t, int32_t>::newNode(RootNode | LeafNode, InvalidPid);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < KeyCount; i++)
+        root->insert(keys[i], i);
+    auto end = std::chrono::steady_clock::now();
+
+    auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"inserted "<<KeyCount<<" random int32 keys in "<<nano_seconds / 1000000<<" ms"<<"\n";
+    std::cout<<"insert throughput per second is:"<<(uint64_t)(KeyCount * 1e9 / nano_seconds)<<"\n";
+    std::cout<<"average insert in nanoseconds is:"<<nano_seconds / KeyCount<<"\n";
+
+    // sanity check a sample of the keys
+    for (uint32_t i = 0; i < KeyCount; i += 1000)
+        if (root->find(keys[i], false).pid == InvalidPid)
+            throw std::runtime_error("Inserted key is not found");
+
+    // bulk load the same keys sorted and deduplicated
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<std::pair<int32_t, int32_t>> items;
+    items.reserve(keys.size());
+    for (auto key : keys)
+        items.emplace_back(key, key);
+
+    BTree<int32_t, int32_t> tree;
+    start = std::chrono::steady_clock::now();
+    auto pages = tree.bulkLoad(items.begin(), items.end(), 1.0);
+    end = std::chrono::steady_clock::now();
+
+    nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"bulk loaded "<<items.size()<<" sorted int32 keys into "<<pages<<" pages in "<<nano_seconds / 1000000<<" ms"<<"\n";
+    std::cout<<"bulk load throughput per second is:"<<(uint64_t)(items.size() * 1e9 / nano_seconds)<<"\n";
+    std::cout<<"bulk load throughput in MB/s is:"<<(uint64_t)pages * PageSize * 1000 / nano_seconds<<"\n";
+
+    return 0;
+}
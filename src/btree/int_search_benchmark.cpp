@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+BufferCache BufferCacheInstance(16);
+
+const uint32_t Lookups = 10 * 1000 * 1000;
+
+// The slotted layout before dense keys: the offset array points at (key, value) records and
+// every probe follows the offset and copies the key out of the record.
+struct SlottedLeaf {
+    alignas(BTreePagerHeader) unsigned char page[PageSize];
+    uint16_t count = 0;
+
+    void build(const std::vector<int64_t>& keys) {
+        auto slots = reinterpret_cast<uint16_t*>(page + BTreePagerHeaderSize);
+        uint16_t upper = PageSize;
+        count = keys.size();
+        for (uint16_t i = 0; i < count; i++) {
+            upper -= 2 * sizeof(int64_t);
+            std::memcpy(page + upper, &keys[i], sizeof(int64_t));
+            std::memcpy(page + upper + sizeof(int64_t), &keys[i], sizeof(int64_t));
+            slots[i] = upper;
+        }
+    }
+
+    bool find(int64_t key, int64_t* value) {
+        auto slots = reinterpret_cast<uint16_t*>(page + BTreePagerHeaderSize);
+        int low = 0, high = count - 1;
+        while (low <= high) {
+            auto mid = (low + high) / 2;
+            int64_t midKey;
+            std::memcpy(&midKey, page + slots[mid], sizeof(int64_t));
+            if (key > midKey)
+                low = mid + 1;
+            else if (key < midKey)
+                high = mid - 1;
+            else {
+                std::memcpy(value, page + slots[mid] + sizeof(int64_t), sizeof(int64_t));
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+template <typename TFind>
+static uint64_t lookupsPerSecond(const std::vector<int64_t>& probes, TFind find) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto probe : probes)
+        find(probe);
+    auto end = std::chrono::steady_clock::now();
+    auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return (uint64_t)(probes.size() * 1e9 / nano_seconds);
+}
+
+int main(int argc, const char * argv[]) {
+    // int64 keys with int64 values, a full dense leaf holds MaxPageSlotSpace / 18 items
+    auto capacity = MaxPageSlotSpace / (2 * sizeof(int64_t) + sizeof(uint16_t));
+    std::mt19937_64 generator(42);
+    std::cout<<"simd level is:"<<(int)GetSimdLevel()<<" (0 scalar, 1 sse4.2, 2 avx2)"<<"\n";
+
+    for (auto occupancy : {25, 50, 75, 100}) {
+        std::vector<int64_t> keys(capacity * occupancy / 100);
+        for (auto& key : keys)
+            key = generator() >> 1;
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        auto leaf = BTreeNode<int64_t, int64_t>::newNode(RootNode | LeafNode, InvalidPid);
+        for (auto key : keys)
+            if (!leaf->append(key, key, 1.0))
+                throw std::runtime_error("Leaf is full");
+        SlottedLeaf slotted;
+        slotted.build(keys);
+
+        // half of the probes miss
+        std::vector<int64_t> probes(Lookups);
+        for (auto& probe : probes)
+            probe = generator() % 2 ? keys[generator() % keys.size()] : (int64_t)(generator() >> 1);
+
+        int64_t sum = 0, slottedSum = 0, scalarSum = 0;
+        auto denseKeys = reinterpret_cast<int64_t*>((unsigned char*)leaf + BTreePagerHeaderSize);
+        auto slottedRate = lookupsPerSecond(probes, [&](int64_t key) {
+            int64_t value;
+            if (slotted.find(key, &value))
+                slottedSum += value;
+        });
+        auto scalarRate = lookupsPerSecond(probes, [&](int64_t key) {
+            auto pos = LowerBound(denseKeys, keys.size(), key, SimdLevel::Scalar);
+            if (pos < keys.size() && denseKeys[pos] == key)
+                scalarSum += key;
+        });
+        auto simdRate = lookupsPerSecond(probes, [&](int64_t key) {
+            auto result = leaf->find(key, false);
+            if (result.pid != InvalidPid)
+                sum += result.data;
+        });
+
+        if (sum != slottedSum || sum != scalarSum)
+            throw std::runtime_error("Lookups returned different values");
+        std::cout<<occupancy<<"% occupancy, "<<keys.size()<<" keys, lookups per second: slotted "<<slottedRate
+            <<", dense scalar "<<scalarRate<<", dense simd "<<simdRate
+            <<", speedup over slotted "<<(double)simdRate / slottedRate<<"x"<<"\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Minimal io_uring on the raw system calls, so the tree builds without liburing. It only does
+// what BufferCache needs: page sized reads and writes, optionally on registered buffers. Not
+// thread safe, callers serialize their use of a ring.
+class IoRing {
+public:
+    IoRing() = default;
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing() { close(); }
+
+    // Set up a ring of entries submission slots. Returns false when the kernel has no io_uring
+    // or doesn't let this process use it, callers then fall back to blocking I/O.
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        _fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (_fd < 0)
+            return false;
+
+        _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        // older kernels map the completion ring apart from the submission ring
+        _single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (_single_mmap)
+            _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+        _sq_ring = mapRing(_sq_size, IORING_OFF_SQ_RING);
+        _cq_ring = _single_mmap ? _sq_ring : mapRing(_cq_size, IORING_OFF_CQ_RING);
+        _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = static_cast<io_uring_sqe*>(mapRing(_sqes_size, IORING_OFF_SQES));
+        if (_sq_ring == nullptr || _cq_ring == nullptr || _sqes == nullptr) {
+            close();
+            return false;
+        }
+
+        auto sq = static_cast<unsigned char*>(_sq_ring);
+        _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        _sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        auto cq = static_cast<unsigned char*>(_cq_ring);
+        _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        _cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        _entries = params.sq_entries;
+        return true;
+    }
+
+    void close() {
+        if (_sqes != nullptr)
+            munmap(_sqes, _sqes_size);
+        if (_cq_ring != nullptr && !_single_mmap)
+            munmap(_cq_ring, _cq_size);
+        if (_sq_ring != nullptr)
+            munmap(_sq_ring, _sq_size);
+        if (_fd >= 0)
+            ::close(_fd);
+        _fd = -1;
+        _sq_ring = _cq_ring = nullptr;
+        _sqes = nullptr;
+        _queued = 0;
+    }
+
+    bool isActive() const { return _fd >= 0; }
+
+    // Register buffers for the fixed opcodes. Fails when the buffers exceed the locked memory
+    // limit of the process.
+    bool registerBuffers(const iovec* buffers, unsigned count) {
+        return syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+    }
+
+    // Queue a read or write of length bytes at offset of fd, through registered buffer
+    // bufferIndex unless it is negative. Returns false when every slot is queued, submit first.
+    bool prepare(uint8_t opcode, int fd, void* address, uint32_t length, uint64_t offset, uint64_t userData, int bufferIndex) {
+        auto tail = *_sq_tail;
+        if (tail - std::atomic_ref<unsigned>(*_sq_head).load(std::memory_order_acquire) == _entries)
+            return false;
+
+        auto index = tail & _sq_mask;
+        auto sqe = &_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(address);
+        sqe->len = length;
+        sqe->off = offset;
+        sqe->user_data = userData;
+        if (bufferIndex >= 0)
+            sqe->buf_index = (uint16_t)bufferIndex;
+        _sq_array[index] = index;
+        std::atomic_ref<unsigned>(*_sq_tail).store(tail + 1, std::memory_order_release);
+        _queued++;
+        return true;
+    }
+
+    // Hand all queued entries to the kernel in one system call, and wait until at least
+    // minComplete completions are ready. Returns false with errno set on failure.
+    bool submit(unsigned minComplete) {
+        while (true) {
+            auto flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0u;
+            auto submitted = syscall(__NR_io_uring_enter, _fd, _queued, minComplete, flags, nullptr, 0);
+            if (submitted >= 0) {
+                _queued -= (unsigned)submitted;
+                return true;
+            }
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    // Call done(userData, result) for every completion that is ready. Returns how many there were.
+    template<typename Done>
+    unsigned reap(Done done) {
+        auto head = *_cq_head;
+        auto tail = std::atomic_ref<unsigned>(*_cq_tail).load(std::memory_order_acquire);
+        for (auto current = head; current != tail; current++) {
+            auto& cqe = _cqes[current & _cq_mask];
+            done(cqe.user_data, cqe.res);
+        }
+        std::atomic_ref<unsigned>(*_cq_head).store(tail, std::memory_order_release);
+        return tail - head;
+    }
+
+    // Entries queued but not submitted yet
+    unsigned getQueued() const { return _queued; }
+
+private:
+    void* mapRing(size_t size, off_t offset) {
+        auto ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+
+    int _fd = -1;
+    bool _single_mmap = false;
+    unsigned _entries = 0;
+    unsigned _queued = 0;
+    void* _sq_ring = nullptr;
+    void* _cq_ring = nullptr;
+    size_t _sq_size = 0;
+    size_t _cq_size = 0;
+    io_uring_sqe* _sqes = nullptr;
+    size_t _sqes_size = 0;
+    unsigned* _sq_head = nullptr;
+    unsigned* _sq_tail = nullptr;
+    unsigned* _sq_array = nullptr;
+    unsigned _sq_mask = 0;
+    unsigned* _cq_head = nullptr;
+    unsigned* _cq_tail = nullptr;
+    unsigned _cq_mask = 0;
+    io_uring_cqe* _cqes = nullptr;
+};
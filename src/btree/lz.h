@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Byte oriented LZ77 codec in the format of LZ4 blocks, for buffers of at most 64KB such as
+// pages. A compressed buffer is a run of sequences: a token byte with the literal count in its
+// high nibble and the match length minus LzMinMatch in its low nibble, a nibble of 15 continuing
+// in bytes of 255 until a smaller one, the literals, then the 2 byte offset back to the match.
+// The last sequence has literals only. The compressor finds matches greedily through a hash of
+// the next 4 bytes, the decompressor checks every length and offset against its buffers, so a
+// damaged buffer fails instead of reading or writing out of bounds.
+
+constexpr size_t LzMinMatch = 4;
+// Matches end at least this many bytes before the end of the buffer, so it ends in literals
+constexpr size_t LzLastLiterals = 5;
+constexpr int LzHashBits = 12;
+// Buffers are at most this long, so offsets and positions fit 16 bits
+constexpr size_t LzMaxSize = 65535;
+
+// Write the length beyond a full nibble as bytes of 255 and a last smaller one. Returns false
+// when they don't fit before end.
+inline bool LzPutLength(unsigned char*& out, const unsigned char* end, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (out == end)
+            return false;
+        *out++ = 255;
+    }
+    if (out == end)
+        return false;
+    *out++ = (unsigned char)length;
+    return true;
+}
+
+// Add the bytes of 255 and the last smaller one to length. Returns false when the input ends.
+inline bool LzGetLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    unsigned char byte;
+    do {
+        if (in == end)
+            return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Emit the literals bytes at anchor, then a match of matchLength bytes offset back unless
+// matchLength is 0. Returns false when the sequence doesn't fit before end.
+inline bool LzPutSequence(unsigned char*& out, const unsigned char* end, const unsigned char* anchor, size_t literals,
+    size_t offset, size_t matchLength) {
+    if (out == end)
+        return false;
+    auto token = out++;
+    auto matchNibble = matchLength == 0 ? 0 : matchLength - LzMinMatch;
+    *token = (unsigned char)((literals < 15 ? literals : 15) << 4 | (matchNibble < 15 ? matchNibble : 15));
+    if (literals >= 15 && !LzPutLength(out, end, literals - 15))
+        return false;
+    if ((size_t)(end - out) < literals)
+        return false;
+    std::memcpy(out, anchor, literals);
+    out += literals;
+    if (matchLength == 0)
+        return true;
+    if (end - out < 2)
+        return false;
+    *out++ = (unsigned char)offset;
+    *out++ = (unsigned char)(offset >> 8);
+    return matchNibble < 15 || LzPutLength(out, end, matchNibble - 15);
+}
+
+// Compress size bytes of source into destination, which has room for capacity bytes. Returns
+// the compressed size, 0 when it would take more than capacity.
+inline size_t LzCompress(const unsigned char* source, size_t size, unsigned char* destination, size_t capacity) {
+    if (size > LzMaxSize)
+        return 0;
+
+    uint16_t table[1 << LzHashBits] = {};
+    auto out = destination;
+    auto end = destination + capacity;
+    size_t anchor = 0;
+    auto matchEnd = size > LzLastLiterals ? size - LzLastLiterals : 0;
+    for (size_t i = 0; i + LzMinMatch <= matchEnd;) {
+        uint32_t sequence;
+        std::memcpy(&sequence, source + i, sizeof(sequence));
+        auto hash = (sequence * 2654435761u) >> (32 - LzHashBits);
+        size_t candidate = table[hash];
+        table[hash] = (uint16_t)i;
+        uint32_t previous;
+        std::memcpy(&previous, source + candidate, sizeof(previous));
+        if (candidate >= i || previous != sequence) {
+            // skip faster through data that doesn't compress
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+
+        auto length = LzMinMatch;
+        while (i + length < matchEnd && source[candidate + length] == source[i + length])
+            length++;
+        if (!LzPutSequence(out, end, source + anchor, i - anchor, i - candidate, length))
+            return 0;
+        i += length;
+        anchor = i;
+    }
+    if (!LzPutSequence(out, end, source + anchor, size - anchor, 0, 0))
+        return 0;
+    return (size_t)(out - destination);
+}
+
+// Decompress size bytes of source into destination, which must come out exactly expected bytes
+// long. Returns false when source is not such a compressed buffer.
+inline bool LzDecompress(const unsigned char* source, size_t size, unsigned char* destination, size_t expected) {
+    auto in = source;
+    auto inEnd = source + size;
+    auto out = destination;
+    auto outEnd = destination + expected;
+    while (in < inEnd) {
+        auto token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !LzGetLength(in, inEnd, literals))
+            return false;
+        if ((size_t)(inEnd - in) < literals || (size_t)(outEnd - out) < literals)
+            return false;
+        std::memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == inEnd)
+            break;
+
+        if (inEnd - in < 2)
+            return false;
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !LzGetLength(in, inEnd, length))
+            return false;
+        length += LzMinMatch;
+        if (offset == 0 || offset > (size_t)(out - destination) || (size_t)(outEnd - out) < length)
+            return false;
+        // a match may overlap the bytes it produces
+        auto match = out - offset;
+        for (size_t i = 0; i < length; i++)
+            out[i] = match[i];
+        out += length;
+    }
+    return out == outEnd;
+}
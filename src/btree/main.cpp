@@ -1,91 +1,23 @@
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <numeric>
 #include <random>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 #include <utility>
 #include <vector>
 #include "btree.h"
 #include "buffercache.h"
+#include "test_data.h"
 
-BufferCache BufferCacheInstance(100);
-
-const size_t MaxStrKeyLength = 30;
-const size_t MaxStrValLength = 70;
-constexpr int32_t Min_int32_value = std::numeric_limits<int32_t>::min();
-constexpr int32_t Max_int32_value = std::numeric_limits<int32_t>::max();
-
-// Define the Unicode range (e.g., Basic Latin, Latin-1 Supplement, Cyrillic, etc.)
-const uint32_t Min_utf8_range = 0x0020;  // Space character (start of printable ASCII)
-const uint32_t Max_utf8_range = 0xFFFF;  // Maximum for Basic Multilingual Plane (BMP)
-
-// Function to generate a random Unicode code point
-uint32_t generate_random_unicode_code_point() {
-    // Create random number generator
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_int_distribution<uint32_t> distribution(Min_utf8_range, Max_utf8_range);
-    return distribution(generator);
-}
-
-static std::string code_point_to_utf8(uint32_t code_point) {
-    std::string utf8_string;
-    
-    if (code_point <= 0x7F) {
-        // 1-byte UTF-8
-        utf8_string += static_cast<char>(code_point);
-    } else if (code_point <= 0x7FF) {
-        // 2-byte UTF-8
-        utf8_string += static_cast<char>((code_point >> 6) | 0xC0);
-        utf8_string += static_cast<char>((code_point & 0x3F) | 0x80);
-    } else if (code_point <= 0xFFFF) {
-        // 3-byte UTF-8
-        utf8_string += static_cast<char>((code_point >> 12) | 0xE0);
-        utf8_string += static_cast<char>(((code_point >> 6) & 0x3F) | 0x80);
-        utf8_string += static_cast<char>((code_point & 0x3F) | 0x80);
-    } else if (code_point <= 0x10FFFF) {
-        // 4-byte UTF-8
-        utf8_string += static_cast<char>((code_point >> 18) | 0xF0);
-        utf8_string += static_cast<char>(((code_point >> 12) & 0x3F) | 0x80);
-        utf8_string += static_cast<char>(((code_point >> 6) & 0x3F) | 0x80);
-        utf8_string += static_cast<char>((code_point & 0x3F) | 0x80);
-    }
-    
-    return utf8_string;
-}
-
-// Function to generate a random Unicode string of specified length
-static std::string generateRandomUnicodeString(const size_t maxLength) {
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_int_distribution<int32_t> int32_distribution(0, maxLength);
-    auto length = int32_distribution(generator);
-    std::string result;
-    for (size_t i = 0; i < length; ++i) {
-        uint32_t code_point = generate_random_unicode_code_point();
-        result += code_point_to_utf8(code_point);
-    }
-
-    return result;
-}
-
-template <typename TKey, typename TVal>
-static void generateRandomTestData(const u_int32_t size, std::vector<TKey>& keys, std::vector<TVal>& values) {
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_int_distribution<int32_t> int32_distribution(Min_int32_value, Max_int32_value);
-
-    if constexpr (std::is_same_v<TKey, int32_t>)
-        for (u_int32_t i = 0; i < size; i++)
-            keys.push_back(int32_distribution(generator));
-    else if constexpr (std::is_same_v<TKey, std::string>)
-        for (u_int32_t i = 0; i < size; i++)
-            keys.push_back(generateRandomUnicodeString(MaxStrKeyLength));
-
-    if constexpr (std::is_same_v<TVal, int32_t>)
-        for (u_int32_t i = 0; i < size; i++)
-            values.push_back(int32_distribution(generator));
-    else if constexpr (std::is_same_v<TVal, std::string>)
-        for (u_int32_t i = 0; i < size; i++)
-            values.push_back(generateRandomUnicodeString(MaxStrValLength));
-}
+BufferCache BufferCacheInstance(16 * 1024);
 
 static void testSerialization() {
     unsigned char page[1000];
@@ -123,16 +55,88 @@ static void testSerialization() {
     auto str2d = deserialize<std::string>(page + pos);
     assert(str2 == str2d);
 
+    auto str2v = deserializeView<std::string>(page + pos);
+    assert(str2 == str2v && (unsigned char*)str2v.data() == page + pos + sizeof(size_t));
+    assert(getSerializedSize(str2v) == getSerializedSize<std::string>(str2));
+    assert(deserializeView<double>(page + getSerializedSize<std::string>(str1)) == d1);
+
     std::cout<<"testSerialization succeeded"<<"\n";
 }
 
+// A POD struct stored as its bytes, as a key it needs the comparisons of the search
+struct TestPoint {
+    int32_t x;
+    int32_t y;
+    double weight;
+
+    auto operator<=>(const TestPoint&) const = default;
+};
+
+void testCodec() {
+    // fixed size types get their size at compile time
+    static_assert(IsFixedSize<int64_t> && IsFixedSize<TestPoint> && BTreeCodec<TestPoint>::FixedSize == sizeof(TestPoint));
+    static_assert(BTreeCodec<std::tuple<int64_t, int32_t>>::FixedSize == 12);
+    static_assert(!IsFixedSize<std::string> && !IsFixedSize<std::tuple<int64_t, std::string>>);
+
+    unsigned char page[1000];
+    auto nested = std::make_tuple(int64_t(-7), std::string("tenant"), std::make_tuple(TestPoint{1, 2, 0.5}, std::string("x")));
+    for (auto format : {FixedRecordFormat, VarintRecordFormat}) {
+        serialize(nested, page, format);
+        assert(getSerializedSize(nested, format) == 8 + getSerializedSize<std::string>("tenant", format) + sizeof(TestPoint) + getSerializedSize<std::string>("x", format));
+        assert(deserialize<decltype(nested)>(page, format) == nested);
+        auto view = deserializeView<decltype(nested)>(page, format);
+        assert(std::get<1>(view) == "tenant" && getSerializedSize(view, format) == getSerializedSize(nested, format));
+        assert(deserializeView<decltype(nested)>(page, page + sizeof(page), format) == view);
+    }
+
+    // lengths read torn are cut off at the end of the page, the elements after them stay inside
+    std::memset(page, 0xFF, sizeof(page));
+    auto end = page + 100;
+    for (auto format : {FixedRecordFormat, VarintRecordFormat}) {
+        auto torn = deserializeView<std::tuple<std::string, int64_t>>(page, end, format);
+        assert((unsigned char*)std::get<0>(torn).data() + std::get<0>(torn).size() == end);
+        assert(deserializeView<std::string>(end - 2, end, format).empty());
+    }
+
+    // composite keys order by tenant then timestamp
+    using TenantKey = std::tuple<std::string, int64_t>;
+    std::map<TenantKey, int64_t> items;
+    BTree<TenantKey, int64_t> tree;
+    std::mt19937 generator(11);
+    for (auto i = 0; i < 20000; i++) {
+        TenantKey key("tenant-" + std::to_string(generator() % 50), (int64_t)(generator() % 100000));
+        if (items.count(key) > 0)
+            continue;
+        items[key] = i;
+        tree.insert(key, i);
+    }
+    for (auto& [key, value] : items)
+        assert(tree.find(key).data == value);
+    assert(tree.find(TenantKey("tenant-50", 0)).pid == InvalidPid);
+    auto expected = items.lower_bound(TenantKey("tenant-7", 0));
+    auto count = tree.scan(TenantKey("tenant-7", 0), TenantKey("tenant-7", INT64_MAX), [&](const TenantKey& key, const int64_t& value) {
+        assert(key == expected->first && value == expected->second);
+        expected++;
+        return true;
+    });
+    assert(count > 0 && expected == items.lower_bound(TenantKey("tenant-8", 0)));
+
+    // fixed size composite keys and POD values are read in place
+    BTree<std::tuple<int64_t, int64_t>, TestPoint> points;
+    for (int64_t i = 0; i < 20000; i++)
+        points.insert(std::make_tuple(i % 100, i), TestPoint{(int32_t)i, (int32_t)-i, i * 0.25});
+    for (int64_t i = 0; i < 20000; i++)
+        assert(points.find(std::make_tuple(i % 100, i)).data == (TestPoint{(int32_t)i, (int32_t)-i, i * 0.25}));
+
+    std::cout<<"testCodec succeeded"<<"\n";
+}
+
 void testOneNodeOnly() {
     unsigned char* page;
     auto pid = BufferCacheInstance.initNextFreePage(&page);
+    InitBTreePage(page, pid, RootNode | LeafNode, InvalidPid);
     auto btreeNode = reinterpret_cast<BTreeNode<int32_t,std::string>*>(page);
-    SetNodeType(&(btreeNode->getHeader()->_info), RootNode | LeafNode);
-    btreeNode->getHeader()->_upper = PageSize;
-    btreeNode->getHeader()->_padding = PageHeaderPadding;
+    assert(btreeNode->getHeader()->_upper == PageSize && btreeNode->getHeader()->_padding == PageHeaderPadding);
     assert(IsRootNode(btreeNode->getHeader()->_info) && IsLeafNode(btreeNode->getHeader()->_info)
         && !IsIntermiediateNode(btreeNode->getHeader()->_info));
 
@@ -146,14 +150,1260 @@ void testOneNodeOnly() {
 
     for (auto i = 0; i < size; i++) {
         auto result = btreeNode->find(keys[i], false);
-        assert(result.pid == 0 && result.data == values[i]);
+        assert(result.pid == pid && result.data == values[i]);
     }
 
     std::cout<<"testRootOnly succeeded"<<"\n";
 }
 
+template <typename TKey, typename TVal>
+static BTreeNode<TKey,TVal>* newRootNode() {
+    return BTreeNode<TKey,TVal>::newNode(RootNode | LeafNode, InvalidPid);
+}
+
+void testSplit() {
+    // unique keys so every lookup has exactly one expected value
+    size_t size = 100000;
+    std::vector<int32_t> keys(size);
+    std::iota(keys.begin(), keys.end(), -50000);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(std::random_device()()));
+
+    auto intRoot = newRootNode<int32_t, int32_t>();
+    auto rootPid = intRoot->getHeader()->_pid;
+    for (auto i = 0; i < size; i++)
+        intRoot->insert(keys[i], keys[i] * 2);
+
+    assert(IsRootNode(intRoot->getHeader()->_info) && IsIntermiediateNode(intRoot->getHeader()->_info));
+    assert(intRoot->getHeader()->_pid == rootPid);
+    for (auto i = 0; i < size; i++) {
+        auto result = intRoot->find(keys[i], false);
+        assert(result.pid != InvalidPid && result.data == keys[i] * 2);
+    }
+    assert(intRoot->find(size, false).pid == InvalidPid);
+
+    size = 20000;
+    std::vector<std::string> values;
+    std::vector<int32_t> unused;
+    generateRandomTestData<int32_t, std::string>(size, unused, values);
+    auto strRoot = newRootNode<int32_t, std::string>();
+    for (auto i = 0; i < size; i++)
+        strRoot->insert(keys[i], values[i]);
+
+    for (auto i = 0; i < size; i++) {
+        auto result = strRoot->find(keys[i], false);
+        assert(result.pid != InvalidPid && result.data == values[i]);
+    }
+
+    std::cout<<"testSplit succeeded"<<"\n";
+}
+
+void testMultiLevelFind() {
+    size_t size = 50000;
+    std::vector<std::string> generated;
+    std::vector<int32_t> unused;
+    generateRandomTestData<std::string, int32_t>(size, generated, unused);
+    std::sort(generated.begin(), generated.end());
+    generated.erase(std::unique(generated.begin(), generated.end()), generated.end());
+    std::vector<std::string> keys(generated.begin() + 1, generated.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(std::random_device()()));
+
+    auto root = newRootNode<std::string, int32_t>();
+    for (auto i = 0; i < keys.size(); i++)
+        root->insert(keys[i], i);
+
+    // walk down the rightmost path, string separators keep the fan-out low enough for 3 levels
+    auto levels = 1;
+    auto header = root->getHeader();
+    while (!IsLeafNode(header->_info)) {
+        header = reinterpret_cast<BTreePagerHeader*>(BufferCacheInstance.get(header->_right_child_pid));
+        levels++;
+    }
+    assert(levels >= 3 && header->_r_pid == InvalidPid);
+
+    for (auto i = 0; i < keys.size(); i++) {
+        auto result = root->find(keys[i], false);
+        assert(result.pid != InvalidPid && result.data == i);
+    }
+    // the smallest generated key was never inserted
+    assert(root->find(generated[0], false).pid == InvalidPid);
+
+    std::cout<<"testMultiLevelFind succeeded"<<"\n";
+}
+
+// Number of leaves of a tree keyed by TKey, counted along the leaf sibling chain
+template <typename TKey = int32_t>
+static uint32_t countLeaves(uint32_t rootPid) {
+    auto node = BTreeInternalNode<TKey>::getNode(rootPid);
+    while (!node->isLeaf())
+        node = BTreeInternalNode<TKey>::getNode(node->getChildPid(0));
+
+    uint32_t leaves = 1;
+    for (auto header = node->getHeader(); header->_r_pid != InvalidPid; header = GetPageHeader(header->_r_pid))
+        leaves++;
+    return leaves;
+}
+
+void testBulkLoad() {
+    size_t size = 100000;
+    std::vector<std::pair<int32_t, int32_t>> items;
+    for (int32_t i = 0; i < size; i++)
+        items.emplace_back(i * 2, i);
+
+    // int32 items take 10 bytes with their offset, a packed leaf takes every item that fits
+    BTree<int32_t, int32_t> packed;
+    auto pages = packed.bulkLoad(items.begin(), items.end(), 1.0);
+    auto itemsPerLeaf = MaxPageSlotSpace / (2 * sizeof(int32_t) + sizeof(uint16_t));
+    auto leaves = (size + itemsPerLeaf - 1) / itemsPerLeaf;
+    assert(pages > leaves && pages < leaves + leaves / 100 + 2);
+    for (auto i = 0; i < size; i++) {
+        auto result = packed.find(i * 2);
+        assert(result.pid != InvalidPid && result.data == i);
+        assert(packed.find(i * 2 + 1).pid == InvalidPid);
+    }
+
+    // a partially filled tree keeps taking inserts between the loaded keys
+    BTree<int32_t, int32_t> sparse;
+    assert(sparse.bulkLoad(items.begin(), items.end(), 0.5) > pages);
+    for (auto i = 0; i < size; i++)
+        sparse.insert(i * 2 + 1, -i);
+    for (auto i = 0; i < size; i++)
+        assert(sparse.find(i * 2).data == i && sparse.find(i * 2 + 1).data == -i);
+
+    std::map<std::string, std::string> strItems;
+    std::vector<std::string> keys, values;
+    generateRandomTestData<std::string, std::string>(20000, keys, values);
+    for (auto i = 0; i < keys.size(); i++)
+        strItems[keys[i]] = values[i];
+    BTree<std::string, std::string> strTree;
+    strTree.bulkLoad(strItems.begin(), strItems.end());
+    for (auto& item : strItems)
+        assert(strTree.find(item.first).data == item.second);
+
+    bool thrown = false;
+    try {
+        std::reverse(items.begin(), items.end());
+        BTree<int32_t, int32_t>().bulkLoad(items.begin(), items.end());
+    } catch (std::runtime_error& e) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // one leaf more than a full parent takes, the last parent still gets a separator
+    items.clear();
+    for (int32_t i = 0; i < (itemsPerLeaf + 1) * itemsPerLeaf + 1; i++)
+        items.emplace_back(i, -i);
+    BTree<int32_t, int32_t> uneven;
+    uneven.bulkLoad(items.begin(), items.end(), 1.0);
+    for (auto header = GetPageHeader(uneven.getRootPid()); !IsLeafNode(header->_info); header = GetPageHeader(header->_right_child_pid))
+        assert(header->_items_count > 0);
+    for (auto& [key, value] : items)
+        assert(uneven.find(key).data == value);
+    assert(countLeaves(uneven.getRootPid()) == itemsPerLeaf + 2);
+
+    std::cout<<"testBulkLoad succeeded"<<"\n";
+}
+
+void testCursor() {
+    std::map<int32_t, int32_t> items;
+    std::vector<int32_t> keys, values;
+    generateRandomTestData<int32_t, int32_t>(50000, keys, values);
+    BTree<int32_t, int32_t> tree;
+    for (auto i = 0; i < keys.size(); i++) {
+        if (items.count(keys[i]) > 0)
+            continue;
+        items[keys[i]] = values[i];
+        tree.insert(keys[i], values[i]);
+    }
+
+    auto it = tree.cursor();
+    auto expected = items.begin();
+    for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+        assert(expected != items.end() && it.key() == expected->first && it.value() == expected->second);
+    assert(expected == items.end());
+
+    auto reversed = items.rbegin();
+    for (auto valid = it.seekLast(); valid; valid = it.prev(), reversed++)
+        assert(reversed != items.rend() && it.key() == reversed->first);
+    assert(reversed == items.rend());
+
+    // a range starting between two keys
+    auto lo = std::next(items.begin(), items.size() / 3)->first + 1;
+    auto hi = std::next(items.begin(), items.size() / 2)->first;
+    expected = items.lower_bound(lo);
+    auto count = tree.scan(lo, hi, [&](const int32_t& key, const int32_t& value) {
+        assert(key == expected->first && value == expected->second);
+        expected++;
+        return true;
+    });
+    assert(count == std::distance(items.lower_bound(lo), items.upper_bound(hi)));
+    assert(tree.scan(lo, hi, [](const int32_t&, const int32_t&) { return false; }) == 1);
+
+    assert(it.seek(items.rbegin()->first) && !it.next());
+    assert(it.seek(items.begin()->first) && !it.prev());
+
+    // insert keeps duplicates, runs of them span several leaves and seek lands on the first
+    std::map<std::string, int32_t> runs;
+    std::vector<std::string> duplicates;
+    for (auto i = 0; i < 300; i++) {
+        auto key = "duplicate " + std::to_string(i * 7);
+        runs[key] = i % 10 == 0 ? 400 : 1 + i % 4;
+        duplicates.insert(duplicates.end(), runs[key], key);
+    }
+    std::shuffle(duplicates.begin(), duplicates.end(), std::mt19937(7));
+    BTree<std::string, std::string> strings;
+    for (auto& key : duplicates)
+        strings.insert(key, std::string(40, 'v'));
+
+    auto seeker = strings.cursor();
+    for (auto& [key, count] : runs) {
+        auto seen = 0;
+        for (auto valid = seeker.seek(key); valid && seeker.key() == key; valid = seeker.next())
+            seen++;
+        assert(seen == count);
+        assert(!seeker.seek(key) || !seeker.prev() || seeker.key() < key);
+    }
+    assert(seeker.seek("duplicate 0") && seeker.key() == "duplicate 0");
+    assert(seeker.seek("duplicate 00") && seeker.key() == runs.lower_bound("duplicate 00")->first);
+
+    std::cout<<"testCursor succeeded"<<"\n";
+}
+
+void testRecordFormat() {
+    // lengths above one byte used to be truncated by deserialize
+    unsigned char buffer[2000];
+    std::string longString(1000, 'x');
+    for (auto format : {FixedRecordFormat, VarintRecordFormat}) {
+        serialize(longString, buffer, format);
+        assert(deserialize<std::string>(buffer, format) == longString);
+        assert(deserializeView<std::string>(buffer, format).size() == longString.size());
+    }
+    assert(getSerializedSize(longString, VarintRecordFormat) == longString.size() + 2);
+    assert(getSerializedSize(longString, FixedRecordFormat) == longString.size() + sizeof(size_t));
+    for (uint64_t value : {0ul, 127ul, 128ul, 16383ul, 16384ul, UINT64_MAX}) {
+        uint64_t decoded;
+        assert(writeVarint(value, buffer) == getVarintSize(value));
+        assert(readVarint(buffer, &decoded) == getVarintSize(value) && decoded == value);
+    }
+
+    // short keys fill a leaf of each format until the first split
+    uint16_t fanOut[2];
+    for (auto format : {FixedRecordFormat, VarintRecordFormat}) {
+        auto root = newRootNode<std::string, int32_t>();
+        SetRecordFormat(&root->getHeader()->_info, format);
+        auto i = 0;
+        for (; IsLeafNode(root->getHeader()->_info); i++)
+            root->insert(std::to_string(1000000 + i), i);
+        fanOut[format >> 4] = i - 1;
+
+        // siblings of a fixed format page keep its format
+        for (auto j = 0; j < i; j++)
+            assert(root->find(std::to_string(1000000 + j), false).data == j);
+        auto child = GetPageHeader(root->getHeader()->_right_child_pid);
+        assert(GetRecordFormat(child->_info) == format && GetRecordFormat(GetPageHeader(child->_l_pid)->_info) == format);
+    }
+    assert(fanOut[1] > fanOut[0] * 1.3);
+
+    std::cout<<"testRecordFormat succeeded"<<"\n";
+}
+
+void testPrefixCompression() {
+    // tenant-prefixed ids share long prefixes within a page
+    std::map<std::string, int32_t> items;
+    std::mt19937 generator(7);
+    for (auto i = 0; items.size() < 50000; i++) {
+        auto id = std::to_string(generator() % 100000000);
+        auto key = "https://tenant-" + std::to_string(generator() % 8) + ".example.com/users/" + std::string(8 - id.size(), '0') + id;
+        items[key] = i;
+    }
+
+    BTree<std::string, int32_t> varint, prefix;
+    prefix.setRecordFormat(PrefixRecordFormat);
+    auto varintPages = varint.bulkLoad(items.begin(), items.end());
+    auto prefixPages = prefix.bulkLoad(items.begin(), items.end());
+    assert(prefixPages * 2 < varintPages);
+    for (auto& item : items)
+        assert(prefix.find(item.first).data == item.second);
+
+    // random inserts shrink prefixes and split pages with different prefixes per half
+    BTree<std::string, int32_t> inserted;
+    inserted.setRecordFormat(PrefixRecordFormat);
+    std::vector<std::pair<std::string, int32_t>> shuffled(items.begin(), items.end());
+    std::shuffle(shuffled.begin(), shuffled.end(), generator);
+    for (auto& item : shuffled)
+        inserted.insert(item.first, item.second);
+    inserted.insert("", -1);
+    inserted.insert("https://tenant-", -2);
+
+    for (auto& item : items)
+        assert(inserted.find(item.first).data == item.second);
+    assert(inserted.find("").data == -1 && inserted.find("https://tenant-").data == -2);
+    assert(inserted.find("https://tenant-1").pid == InvalidPid && inserted.find("zzz").pid == InvalidPid);
+
+    auto it = inserted.cursor();
+    assert(it.seekFirst() && it.key() == "" && it.next() && it.key() == "https://tenant-");
+    auto expected = items.begin();
+    for (auto valid = it.next(); valid; valid = it.next(), expected++)
+        assert(it.key() == expected->first && it.value() == expected->second);
+    assert(expected == items.end());
+
+    std::cout<<"testPrefixCompression succeeded"<<"\n";
+}
+
+void testDenseKeys() {
+    // every kernel agrees with std::lower_bound on windows of all lengths, duplicates included
+    std::mt19937 generator(11);
+    std::vector<int32_t> keys32(200);
+    std::vector<int64_t> keys64(200);
+    for (auto i = 0; i < keys32.size(); i++) {
+        keys32[i] = (int32_t)(generator() % 300) - 150;
+        keys64[i] = (int64_t)keys32[i] << 33;
+    }
+    std::sort(keys32.begin(), keys32.end());
+    std::sort(keys64.begin(), keys64.end());
+    for (auto level : {SimdLevel::Scalar, SimdLevel::Sse42, SimdLevel::Avx2}) {
+        if (level > GetSimdLevel())
+            continue;
+        for (auto count = 0; count <= keys32.size(); count += 7) {
+            for (int32_t key = -160; key <= 160; key++) {
+                auto expected = std::lower_bound(keys32.begin(), keys32.begin() + count, key) - keys32.begin();
+                assert(LowerBound(keys32.data(), count, key, level) == expected);
+                expected = std::lower_bound(keys64.begin(), keys64.begin() + count, (int64_t)key << 33) - keys64.begin();
+                assert(LowerBound(keys64.data(), count, (int64_t)key << 33, level) == expected);
+            }
+        }
+    }
+
+    // int64 keys live in a sorted array right after the page header
+    std::map<int64_t, int64_t> items;
+    BTree<int64_t, int64_t> tree;
+    for (auto i = 0; items.size() < 50000; i++) {
+        int64_t key = ((int64_t)generator() << 32) - ((int64_t)generator() << 16);
+        if (items.count(key) > 0)
+            continue;
+        items[key] = i;
+        tree.insert(key, i);
+    }
+    for (auto& item : items)
+        assert(tree.find(item.first).data == item.second);
+    assert(tree.find(INT64_MIN).pid == InvalidPid && tree.find(INT64_MAX).pid == InvalidPid);
+
+    auto it = tree.cursor();
+    auto expected = items.begin();
+    for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+        assert(it.key() == expected->first && it.value() == expected->second);
+    assert(expected == items.end());
+
+    auto leaf = GetPageHeader(tree.find(items.begin()->first).pid);
+    auto leafKeys = reinterpret_cast<int64_t*>((unsigned char*)leaf + BTreePagerHeaderSize);
+    assert(leaf->_items_count > 1 && leafKeys[0] == items.begin()->first);
+    assert(std::is_sorted(leafKeys, leafKeys + leaf->_items_count));
+
+    std::cout<<"testDenseKeys succeeded"<<"\n";
+}
+
+void testRemove() {
+    size_t size = 100000;
+    std::vector<int32_t> keys(size);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(9));
+    BTree<int32_t, int32_t> tree;
+    for (auto key : keys)
+        tree.insert(key, key * 2);
+    auto leaves = countLeaves(tree.getRootPid());
+
+    // merges shrink the tree as keys go away
+    for (auto key : keys)
+        if (key % 4 != 0)
+            assert(tree.remove(key));
+    assert(!tree.remove(1) && !tree.remove(-1));
+    assert(countLeaves(tree.getRootPid()) < leaves / 2);
+    for (int32_t key = 0; key < size; key++)
+        assert(tree.find(key).pid == InvalidPid || (key % 4 == 0 && tree.find(key).data == key * 2));
+    auto it = tree.cursor();
+    int32_t expected = 0;
+    for (auto valid = it.seekFirst(); valid; valid = it.next(), expected += 4)
+        assert(it.key() == expected && it.value() == expected * 2);
+    assert(expected == size);
+
+    // an emptied tree collapses into a root leaf and grows back to the same shape
+    for (auto key : keys)
+        if (key % 4 == 0)
+            assert(tree.remove(key));
+    auto root = GetPageHeader(tree.getRootPid());
+    assert(IsLeafNode(root->_info) && root->_items_count == 0 && !tree.cursor().seekFirst());
+    for (auto key : keys)
+        tree.insert(key, key);
+    assert(countLeaves(tree.getRootPid()) == leaves);
+
+    // prefix compressed leaves are refilled from siblings with other prefixes
+    std::map<std::string, int32_t> items;
+    std::mt19937 generator(13);
+    for (auto i = 0; items.size() < 30000; i++)
+        items["tenant-" + std::to_string(generator() % 16) + "/item-" + std::to_string(generator())] = i;
+    BTree<std::string, int32_t> strTree;
+    strTree.setRecordFormat(PrefixRecordFormat);
+    std::vector<std::pair<std::string, int32_t>> shuffled(items.begin(), items.end());
+    std::shuffle(shuffled.begin(), shuffled.end(), generator);
+    for (auto& item : shuffled)
+        strTree.insert(item.first, item.second);
+    for (auto i = 0; i < shuffled.size(); i++)
+        if (i % 5 != 0) {
+            assert(strTree.remove(shuffled[i].first));
+            items.erase(shuffled[i].first);
+        }
+    auto strIt = strTree.cursor();
+    auto strExpected = items.begin();
+    for (auto valid = strIt.seekFirst(); valid; valid = strIt.next(), strExpected++)
+        assert(strExpected != items.end() && strIt.key() == strExpected->first && strIt.value() == strExpected->second);
+    assert(strExpected == items.end());
+
+    std::cout<<"testRemove succeeded"<<"\n";
+}
+
+template <typename TKey>
+static void runDefragment(std::function<TKey(int32_t)> makeKey, uint16_t format) {
+    // the number of items a root leaf holds before it splits
+    int32_t capacity = 0;
+    {
+        BTree<TKey, std::string> tree;
+        tree.setRecordFormat(format);
+        while (IsLeafNode(GetPageHeader(tree.getRootPid())->_info)) {
+            tree.insert(makeKey(capacity), std::string(100, 'a' + capacity % 26));
+            capacity++;
+        }
+        capacity--;
+    }
+
+    // removing every other item of a full leaf leaves holes, the items put back fill them
+    BTree<TKey, std::string> tree;
+    tree.setRecordFormat(format);
+    for (int32_t i = 0; i < capacity; i++)
+        tree.insert(makeKey(i), std::string(100, 'a' + i % 26));
+    auto root = GetPageHeader(tree.getRootPid());
+    for (int32_t i = 0; i < capacity; i += 2)
+        assert(tree.remove(makeKey(i)));
+    assert(IsLeafNode(root->_info) && root->_free_space > 0);
+    for (int32_t i = 0; i < capacity; i += 2)
+        tree.insert(makeKey(i), std::string(100, 'A' + i % 26));
+    assert(IsLeafNode(root->_info) && root->_free_space == 0);
+    for (int32_t i = 0; i < capacity; i++)
+        assert(tree.find(makeKey(i)).data == std::string(100, (i % 2 == 0 ? 'A' : 'a') + i % 26));
+}
+
+void testDefragment() {
+    runDefragment<int32_t>([](int32_t i) { return i; }, VarintRecordFormat);
+    runDefragment<std::string>([](int32_t i) {
+        auto digits = std::to_string(i);
+        return "item-" + std::string(6 - digits.size(), '0') + digits;
+    }, PrefixRecordFormat);
+
+    std::cout<<"testDefragment succeeded"<<"\n";
+}
+
+void testMultiGet() {
+    std::map<std::string, int32_t> items;
+    std::vector<std::string> keys;
+    std::vector<int32_t> values;
+    generateRandomTestData<std::string, int32_t>(30000, keys, values);
+    BTree<std::string, int32_t> tree;
+    for (auto i = 0; i < keys.size(); i++) {
+        if (items.count(keys[i]) > 0)
+            continue;
+        items[keys[i]] = values[i];
+        tree.insert(keys[i], values[i]);
+    }
+
+    // unsorted probes with duplicates and misses, results stay in probe order
+    std::vector<std::string> probes;
+    for (auto i = 0; i < keys.size(); i += 3)
+        probes.push_back(i % 2 == 0 ? keys[i] : keys[i] + "-missing");
+    probes.push_back(keys[0]);
+    std::vector<FindResult<int32_t>> results(probes.size(), FindResult<int32_t>(InvalidPid));
+    tree.multiGet(probes, results);
+    for (auto i = 0; i < probes.size(); i++) {
+        auto item = items.find(probes[i]);
+        if (item == items.end())
+            assert(results[i].pid == InvalidPid);
+        else
+            assert(results[i].pid == tree.find(probes[i]).pid && results[i].data == item->second);
+    }
+
+    // a root leaf answers the batch directly
+    BTree<int64_t, int64_t> small;
+    small.insert(5, 50);
+    std::vector<int64_t> smallProbes = {7, 5};
+    std::vector<FindResult<int64_t>> smallResults(2, FindResult<int64_t>(0));
+    small.multiGet(smallProbes, smallResults);
+    assert(smallResults[0].pid == InvalidPid && smallResults[1].data == 50);
+
+    std::cout<<"testMultiGet succeeded"<<"\n";
+}
+
+void testUpsert() {
+    // counters are overwritten in place, the leaves don't change shape
+    BTree<int64_t, int64_t> counters;
+    for (int64_t key = 0; key < 50000; key++)
+        counters.insert(key, 0);
+    auto leaves = countLeaves<int64_t>(counters.getRootPid());
+    auto leaf = GetPageHeader(counters.find(100).pid);
+    auto upper = leaf->_upper;
+    for (auto round = 1; round <= 3; round++)
+        for (int64_t key = 0; key < 50000; key++)
+            counters.upsert(key, round);
+    assert(leaf->_upper == upper && leaf->_free_space == 0 && countLeaves<int64_t>(counters.getRootPid()) == leaves);
+    for (int64_t key = 0; key < 50000; key++)
+        assert(counters.find(key).data == 3);
+    counters.upsert(50000, 7);
+    assert(counters.find(50000).data == 7);
+
+    // string values shrink in place and move within the page when they grow
+    std::map<std::string, std::string> items;
+    std::vector<std::string> keys, values;
+    generateRandomTestData<std::string, std::string>(20000, keys, values);
+    BTree<std::string, std::string> tree;
+    tree.setRecordFormat(PrefixRecordFormat);
+    for (auto i = 0; i < keys.size(); i++) {
+        items[keys[i]] = values[i];
+        tree.upsert(keys[i], values[i]);
+    }
+    std::mt19937 generator(19);
+    for (auto& item : items) {
+        item.second = std::string(generator() % 200, 'a' + generator() % 26);
+        tree.upsert(item.first, item.second);
+    }
+
+    auto it = tree.cursor();
+    auto expected = items.begin();
+    for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+        assert(expected != items.end() && it.key() == expected->first && it.value() == expected->second);
+    assert(expected == items.end());
+
+    std::cout<<"testUpsert succeeded"<<"\n";
+}
+
+void testOverflow() {
+    // values from empty up to several pages, the long ones only leave a PID in the leaf
+    for (auto format : {FixedRecordFormat, VarintRecordFormat}) {
+        std::map<int32_t, std::string> items;
+        std::mt19937 generator(23);
+        BTree<int32_t, std::string> tree;
+        tree.setRecordFormat(format);
+        for (int32_t key = 0; key < 100; key++) {
+            auto length = key % 4 == 0 ? generator() % 30000 : generator() % 100;
+            items[key] = std::string(length, 'a' + key % 26);
+            tree.insert(key, items[key]);
+        }
+        assert(IsLeafNode(GetPageHeader(tree.getRootPid())->_info));
+        for (auto& item : items)
+            assert(tree.find(item.first).data == item.second);
+
+        // values switch between inline and overflow, removes free their overflow pages
+        for (int32_t key = 0; key < 100; key++) {
+            if (key % 3 == 0) {
+                assert(tree.remove(key));
+                items.erase(key);
+                continue;
+            }
+            items[key] = std::string(key % 2 == 0 ? generator() % 30000 : generator() % 100, 'A' + key % 26);
+            tree.upsert(key, items[key]);
+        }
+        auto it = tree.cursor();
+        auto expected = items.begin();
+        for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+            assert(expected != items.end() && it.key() == expected->first && it.value() == expected->second);
+        assert(expected == items.end());
+    }
+
+    // a leaf of long values splits and merges with the PIDs of their overflow pages
+    BTree<std::string, std::string> tree;
+    std::string value(MaxInlineValueLength + 1, 'x');
+    for (auto i = 0; i < 5000; i++)
+        tree.insert("key-" + std::to_string(i), value + std::to_string(i));
+    for (auto i = 0; i < 5000; i += 2)
+        assert(tree.remove("key-" + std::to_string(i)));
+    for (auto i = 1; i < 5000; i += 2)
+        assert(tree.find("key-" + std::to_string(i)).data == value + std::to_string(i));
+
+    std::cout<<"testOverflow succeeded"<<"\n";
+}
+
+template <typename TKey>
+static void runConcurrentUpdates(const std::vector<TKey>& keys, int writers) {
+    // writers insert interleaved slices while a reader checks that every hit has the right value
+    BTree<TKey, int32_t> tree;
+    std::atomic<int> running = writers;
+    std::vector<std::thread> threads;
+    for (auto w = 0; w < writers; w++)
+        threads.emplace_back([&, w]() {
+            for (auto i = w; i < keys.size(); i += writers)
+                tree.insert(keys[i], i);
+            running--;
+        });
+    threads.emplace_back([&]() {
+        std::mt19937 generator(3);
+        while (running > 0) {
+            auto i = generator() % keys.size();
+            auto result = tree.find(keys[i]);
+            assert(result.pid == InvalidPid || result.data == i);
+        }
+    });
+    for (auto& thread : threads)
+        thread.join();
+
+    for (auto i = 0; i < keys.size(); i++)
+        assert(tree.find(keys[i]).data == i);
+
+    // the writers remove the first half of their slices again
+    threads.clear();
+    for (auto w = 0; w < writers; w++)
+        threads.emplace_back([&, w]() {
+            for (auto i = w; i < keys.size() / 2; i += writers)
+                assert(tree.remove(keys[i]));
+        });
+    for (auto& thread : threads)
+        thread.join();
+    for (auto i = 0; i < keys.size(); i++)
+        assert(tree.find(keys[i]).pid == InvalidPid || i >= keys.size() / 2);
+
+    std::vector<TKey> sorted(keys.begin() + keys.size() / 2, keys.end());
+    std::sort(sorted.begin(), sorted.end());
+    auto it = tree.cursor();
+    auto expected = sorted.begin();
+    for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+        assert(expected != sorted.end() && it.key() == *expected);
+    assert(expected == sorted.end());
+}
+
+void testConcurrentUpdates() {
+    std::vector<int32_t> keys(200000);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(5));
+    runConcurrentUpdates(keys, 4);
+
+    // string keys are searched in place, with lengths cut off at the page end
+    std::vector<std::string> generated;
+    std::vector<int32_t> unused;
+    generateRandomTestData<std::string, int32_t>(30000, generated, unused);
+    std::sort(generated.begin(), generated.end());
+    generated.erase(std::unique(generated.begin(), generated.end()), generated.end());
+    std::shuffle(generated.begin(), generated.end(), std::mt19937(5));
+    runConcurrentUpdates(generated, 4);
+
+    std::cout<<"testConcurrentUpdates succeeded"<<"\n";
+}
+
+void testPersistence() {
+    auto path = (std::filesystem::temp_directory_path() / "btree_persistence_test.db").string();
+    std::filesystem::remove(path);
+
+    // the pages of the earlier tests are dropped, the cache starts over backed by the file
+    BufferCacheInstance.close();
+    BufferCacheInstance.open(path);
+    std::map<int32_t, std::string> items;
+    {
+        BTree<int32_t, std::string> tree;
+        for (int32_t key = 0; key < 9000; key++) {
+            items[key] = std::string(key % 2 == 0 ? 10000 : 50, 'a' + key % 26);
+            tree.insert(key, items[key]);
+        }
+        // enough free pages for the free list to continue in trunk pages
+        for (int32_t key = 0; key < 9000; key++)
+            if (key % 3 != 1) {
+                assert(tree.remove(key));
+                items.erase(key);
+            }
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+    }
+    auto freePages = BufferCacheInstance.getFreePageCount();
+    assert(freePages > SuperblockFreeCapacity + TrunkFreeCapacity);
+    BufferCacheInstance.close();
+
+    BufferCacheInstance.open(path);
+    assert(BufferCacheInstance.getFreePageCount() == freePages);
+    BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+    auto it = tree.cursor();
+    auto expected = items.begin();
+    for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+        assert(expected != items.end() && it.key() == expected->first && it.value() == expected->second);
+    assert(expected == items.end());
+
+    // freed pages are handed out again
+    tree.insert(-1, std::string(10000, 'z'));
+    assert(tree.find(-1).data == std::string(10000, 'z') && BufferCacheInstance.getFreePageCount() < freePages);
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testPersistence succeeded"<<"\n";
+}
+
+void testEviction() {
+    // an in-memory arena stops at its size
+    BufferCache arena(2);
+    unsigned char* page;
+    arena.initNextFreePage(&page);
+    arena.initNextFreePage(&page);
+    bool thrown = false;
+    try {
+        arena.initNextFreePage(&page);
+    } catch (std::runtime_error& e) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // a tree of a few hundred pages goes through 128 frames
+    auto path = (std::filesystem::temp_directory_path() / "btree_eviction_test.db").string();
+    std::filesystem::remove(path);
+    BufferCacheInstance.close();
+    BufferCacheInstance.open(path, 128);
+    std::map<int32_t, std::string> items;
+    {
+        BTree<int32_t, std::string> tree;
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        for (int32_t key = 0; key < 40000; key++) {
+            items[key] = std::string(key % 1000 == 0 ? 20000 : 100, 'a' + key % 26);
+            tree.insert(key, items[key]);
+        }
+        for (int32_t key = 0; key < 40000; key += 2) {
+            assert(tree.remove(key));
+            items.erase(key);
+        }
+
+        // writers and readers pin their pages while others evict
+        std::vector<std::thread> threads;
+        for (auto t = 0; t < 4; t++)
+            threads.emplace_back([&tree, t]() {
+                for (int32_t key = 40000 + t; key < 60000; key += 4) {
+                    tree.insert(key, std::string(100, 'a' + key % 26));
+                    assert(tree.find(key - 39999).pid == InvalidPid || tree.find(key - 39999).data.size() == 100);
+                }
+            });
+        for (auto& thread : threads)
+            thread.join();
+        for (int32_t key = 40000; key < 60000; key++)
+            items[key] = std::string(100, 'a' + key % 26);
+
+        for (auto& item : items)
+            assert(tree.find(item.first).data == item.second);
+    }
+    assert(BufferCacheInstance.getMissCount() > 0 && BufferCacheInstance.getHitRate() < 1.0);
+    BufferCacheInstance.close();
+
+    BufferCacheInstance.open(path, 128);
+    BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+    auto it = tree.cursor();
+    auto expected = items.begin();
+    for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+        assert(expected != items.end() && it.key() == expected->first && it.value() == expected->second);
+    assert(expected == items.end());
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testEviction succeeded"<<"\n";
+}
+
+void testPageTable() {
+    // erases shift later entries back, the table must agree with a map through any mix of them
+    BufferPageTable table;
+    table.reset(512);
+    std::map<uint32_t, uint32_t> expected;
+    std::mt19937 generator(23);
+    for (auto i = 0; i < 100000; i++) {
+        auto pid = generator() % 2048;
+        auto entry = expected.find(pid);
+        if (entry != expected.end()) {
+            assert(table.find(pid) == entry->second);
+            table.erase(pid);
+            expected.erase(entry);
+        } else if (expected.size() < 512) {
+            table.insert(pid, i);
+            expected[pid] = i;
+        }
+        assert(table.find(generator() % 2048 + 2048) == UINT32_MAX);
+    }
+    for (auto& entry : expected)
+        assert(table.find(entry.first) == entry.second);
+
+    // threads allocating and freeing at once never hand out a page twice
+    BufferCache cache(4096);
+    std::vector<std::vector<uint32_t>> allocated(8);
+    std::vector<std::thread> threads;
+    for (auto t = 0; t < 8; t++)
+        threads.emplace_back([&cache, &allocated, t]() {
+            unsigned char* page;
+            for (auto i = 0; i < 1000; i++) {
+                auto pid = cache.initNextFreePage(&page);
+                // the page is the caller's, a second owner would see the mark change
+                std::memset(page, t, PageSize);
+                allocated[t].push_back(pid);
+                if (i % 2 == 0) {
+                    cache.free(allocated[t].back());
+                    allocated[t].pop_back();
+                }
+            }
+            for (auto pid : allocated[t])
+                assert(cache.get(pid)[PageSize - 1] == t);
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    std::vector<uint32_t> pids;
+    for (auto& own : allocated)
+        pids.insert(pids.end(), own.begin(), own.end());
+    std::sort(pids.begin(), pids.end());
+    assert(pids.size() == 4000 && std::adjacent_find(pids.begin(), pids.end()) == pids.end());
+    assert(pids.back() < 4096 && cache.getFreePageCount() <= 8);
+
+    std::cout<<"testPageTable succeeded"<<"\n";
+}
+
+void testAsyncFind() {
+    auto path = (std::filesystem::temp_directory_path() / "btree_async_test.db").string();
+    std::filesystem::remove(path);
+    BufferCacheInstance.close();
+    BufferCacheInstance.open(path, 64);
+    {
+        BTree<int32_t, int32_t> tree;
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        for (int32_t key = 0; key < 100000; key += 2)
+            tree.insert(key, key * 3);
+    }
+    BufferCacheInstance.close();
+
+    // every lookup starts cold, the reads of all of them go out together
+    BufferCacheInstance.open(path, 64);
+    BTree<int32_t, int32_t> tree(BufferCacheInstance.getRootPid());
+    std::vector<int32_t> keys;
+    std::vector<Task<FindResult<int32_t>>> tasks;
+    for (int32_t i = 0; i < 32; i++) {
+        keys.push_back(i * 3001);
+        tasks.push_back(tree.findAsync(keys.back()));
+        tasks.back().start();
+    }
+    auto suspended = std::count_if(tasks.begin(), tasks.end(), [](auto& task) { return !task.done(); });
+    assert(!BufferCacheInstance.isAsync() || suspended > 0);
+    while (std::any_of(tasks.begin(), tasks.end(), [](auto& task) { return !task.done(); }))
+        BufferCacheInstance.poll();
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        auto result = tasks[i].result();
+        if (keys[i] % 2 == 0)
+            assert(result.pid != InvalidPid && result.data == keys[i] * 3);
+        else
+            assert(result.pid == InvalidPid);
+    }
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testAsyncFind succeeded"<<"\n";
+}
+
+void testArena() {
+    // whatever backs it, the arena starts on a huge page and every page is usable
+    BufferCache cache(1000, true);
+    std::vector<unsigned char*> pages(1000);
+    for (uint32_t i = 0; i < pages.size(); i++) {
+        assert(cache.initNextFreePage(&pages[i]) == i);
+        std::memset(pages[i], i % 251, PageSize);
+    }
+    assert(reinterpret_cast<uintptr_t>(pages[0]) % ArenaHugePageSize == 0);
+    for (uint32_t i = 0; i < pages.size(); i++)
+        assert(cache.get(i) == pages[i] && pages[i][PageSize - 1] == i % 251);
+    assert(cache.getArenaNodeCount() >= 1);
+
+    std::cout<<"testArena succeeded"<<"\n";
+}
+
+void testScan() {
+    auto path = (std::filesystem::temp_directory_path() / "btree_scan_test.db").string();
+    std::filesystem::remove(path);
+    BufferCacheInstance.close();
+    BufferCacheInstance.open(path, 256);
+    {
+        BTree<int32_t, std::string> tree;
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        for (int32_t key = 0; key < 200000; key++)
+            tree.insert(key, std::string(100, 'a' + key % 26));
+    }
+    BufferCacheInstance.close();
+
+    // a cold scan finds most leaves read ahead
+    BufferCacheInstance.open(path, 256);
+    BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+    auto scan = [&tree]() {
+        auto it = tree.cursor();
+        int32_t expected = 0;
+        for (auto valid = it.seekFirst(); valid; valid = it.next(), expected++)
+            assert(it.key() == expected && it.value()[0] == 'a' + expected % 26);
+        assert(expected == 200000);
+    };
+    scan();
+    if (BufferCacheInstance.isAsync())
+        assert(BufferCacheInstance.getReadAheadCount() > 0 && BufferCacheInstance.getMissCount() < 300);
+
+    // scans recycle their own frames and leave the pages of point lookups cached
+    std::vector<int32_t> hot;
+    for (int32_t key = 0; key < 200000; key += 4001)
+        hot.push_back(key);
+    for (auto key : hot)
+        assert(tree.find(key).data[0] == 'a' + key % 26);
+    scan();
+    auto misses = BufferCacheInstance.getMissCount();
+    for (auto key : hot)
+        assert(tree.find(key).data[0] == 'a' + key % 26);
+    assert(BufferCacheInstance.getMissCount() == misses);
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testScan succeeded"<<"\n";
+}
+
+void testRecovery() {
+    auto path = (std::filesystem::temp_directory_path() / "btree_recovery_test.db").string();
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + WalFileSuffix);
+    BufferCacheInstance.close();
+    auto valueOf = [](int32_t key) { return std::string(key % 500 == 0 ? 20000 : 100, 'a' + key % 26); };
+
+    // a child writes through a durable cache and dies without a checkpoint, so the file only
+    // has the log and the pages evicted on the way
+    auto child = fork();
+    if (child == 0) {
+        BufferCacheInstance.open(path, 64, true);
+        BTree<int32_t, std::string> tree;
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        std::vector<std::thread> threads;
+        for (auto t = 0; t < 4; t++)
+            threads.emplace_back([&tree, &valueOf, t]() {
+                for (int32_t key = t; key < 20000; key += 4)
+                    tree.insert(key, valueOf(key));
+                for (int32_t key = t; key < 20000; key += 8)
+                    assert(tree.remove(key));
+            });
+        for (auto& thread : threads)
+            thread.join();
+        assert(BufferCacheInstance.getLogWriteCount() > 0);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(std::filesystem::file_size(path + WalFileSuffix) > 0);
+
+    // opening redoes the log, after a clean close the file alone holds every change
+    for (auto durable : {true, false}) {
+        BufferCacheInstance.open(path, 64, durable);
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        auto it = tree.cursor();
+        int32_t count = 0;
+        for (auto valid = it.seekFirst(); valid; valid = it.next(), count++)
+            assert(it.key() % 8 >= 4 && it.value() == valueOf(it.key()));
+        assert(count == 10000);
+        for (int32_t key = 0; key < 20000; key += 7)
+            assert(key % 8 < 4 ? tree.find(key).pid == InvalidPid : tree.find(key).data == valueOf(key));
+        BufferCacheInstance.close();
+        assert(!std::filesystem::exists(path + WalFileSuffix));
+    }
+    std::filesystem::remove(path);
+
+    // a bulk load fills its new pages unlatched, the log has them whole
+    child = fork();
+    if (child == 0) {
+        BufferCacheInstance.open(path, 64, true);
+        std::vector<std::pair<int32_t, int32_t>> items;
+        for (int32_t key = 0; key < 200000; key++)
+            items.emplace_back(key * 3, key);
+        BTree<int32_t, int32_t> tree;
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        tree.bulkLoad(items.begin(), items.end());
+        _exit(0);
+    }
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    BufferCacheInstance.open(path, 64, true);
+    {
+        BTree<int32_t, int32_t> tree(BufferCacheInstance.getRootPid());
+        for (int32_t key = 0; key < 200000; key++)
+            assert(tree.find(key * 3).data == key && tree.find(key * 3 + 1).pid == InvalidPid);
+        assert(countLeaves(tree.getRootPid()) > 200);
+    }
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testRecovery succeeded"<<"\n";
+}
+
+void testCheckpoint() {
+    auto path = (std::filesystem::temp_directory_path() / "btree_checkpoint_test.db").string();
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + WalFileSuffix);
+    BufferCacheInstance.close();
+    auto valueOf = [](int32_t key) { return std::string(key % 500 == 0 ? 20000 : 100, 'a' + key % 26); };
+
+    // a child checkpoints while its threads write, then writes some more and dies, so recovery
+    // starts from the last checkpoint and redoes the rest
+    auto child = fork();
+    if (child == 0) {
+        BufferCacheInstance.open(path, 64, true);
+        BTree<int32_t, std::string> tree;
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        BufferCacheInstance.startCheckpointer(100000, 64 * 1024);
+        std::vector<std::thread> threads;
+        for (auto t = 0; t < 4; t++)
+            threads.emplace_back([&tree, &valueOf, t]() {
+                for (int32_t key = t; key < 20000; key += 4)
+                    tree.insert(key, valueOf(key));
+                // pages change under this one
+                if (t == 0)
+                    BufferCacheInstance.checkpoint();
+                for (int32_t key = t; key < 20000; key += 8)
+                    assert(tree.remove(key));
+            });
+        for (auto& thread : threads)
+            thread.join();
+        BufferCacheInstance.stopCheckpointer();
+        assert(BufferCacheInstance.getCheckpointCount() > 0);
+        assert(BufferCacheInstance.getCheckpointPageCount() > 0);
+        assert(BufferCacheInstance.getDirtyRatio() >= 0 && BufferCacheInstance.getDirtyRatio() <= 1);
+        for (int32_t key = 20000; key < 21000; key++)
+            tree.insert(key, valueOf(key));
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    BufferCacheInstance.open(path, 64, true);
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        auto it = tree.cursor();
+        int32_t count = 0;
+        for (auto valid = it.seekFirst(); valid; valid = it.next(), count++)
+            assert((it.key() >= 20000 || it.key() % 8 >= 4) && it.value() == valueOf(it.key()));
+        assert(count == 11000);
+        for (int32_t key = 0; key < 21000; key += 7)
+            assert(key < 20000 && key % 8 < 4 ? tree.find(key).pid == InvalidPid : tree.find(key).data == valueOf(key));
+    }
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testCheckpoint succeeded"<<"\n";
+}
+
+void testChecksum() {
+    auto path = (std::filesystem::temp_directory_path() / "btree_checksum_test.db").string();
+    std::filesystem::remove(path);
+    BufferCacheInstance.close();
+    auto valueOf = [](int32_t key) { return std::string(100, 'a' + key % 26); };
+
+    BufferCacheInstance.open(path, 64);
+    uint32_t leafPid;
+    {
+        BTree<int32_t, std::string> tree;
+        for (int32_t key = 0; key < 5000; key++)
+            tree.insert(key, valueOf(key));
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        leafPid = tree.find(2500).pid;
+    }
+    BufferCacheInstance.close();
+
+    // damage the checksum of a leaf in the file, its items stay intact
+    auto fd = ::open(path.c_str(), O_RDWR);
+    uint32_t crc = 0;
+    assert(pread(fd, &crc, sizeof(crc), (off_t)leafPid * PageSize + PageChecksumOffset) == sizeof(crc));
+    crc ^= 1;
+    assert(pwrite(fd, &crc, sizeof(crc), (off_t)leafPid * PageSize + PageChecksumOffset) == sizeof(crc));
+    ::close(fd);
+
+    BufferCacheInstance.open(path, 64);
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        assert(tree.find(0).data == valueOf(0) && BufferCacheInstance.getChecksumFailureCount() == 0);
+        auto failed = false;
+        try {
+            tree.find(2500);
+        } catch (const std::runtime_error&) {
+            failed = true;
+        }
+        assert(failed && BufferCacheInstance.getChecksumFailureCount() == 1);
+
+        if (BufferCacheInstance.isAsync()) {
+            auto task = tree.findAsync(2500);
+            task.start();
+            while (!task.done())
+                BufferCacheInstance.poll();
+            failed = false;
+            try {
+                task.result();
+            } catch (const std::runtime_error&) {
+                failed = true;
+            }
+            assert(failed && BufferCacheInstance.getChecksumFailureCount() == 2);
+        }
+
+        // a read path that skips verification takes the page as it is
+        BufferCacheInstance.setChecksumReads(ChecksumAllReads & ~ChecksumMissReads);
+        for (int32_t key = 0; key < 5000; key++)
+            assert(tree.find(key).data == valueOf(key));
+        BufferCacheInstance.setChecksumReads(ChecksumAllReads);
+    }
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testChecksum succeeded"<<"\n";
+}
+
+void testCompression() {
+    // the codec takes repetitive bytes back from a fraction of their size, and fails on damage
+    std::vector<unsigned char> page(PageSize), compressed(PageSize), restored(PageSize);
+    for (size_t i = 0; i < PageSize; i++)
+        page[i] = "{\"city\":\"Seattle\",\"id\":"[i % 22] + (i % 97 == 0);
+    auto size = LzCompress(page.data(), PageSize, compressed.data(), PageSize);
+    assert(size > 0 && size < PageSize / 4);
+    assert(LzDecompress(compressed.data(), size, restored.data(), PageSize) && restored == page);
+    assert(!LzDecompress(compressed.data(), size - 1, restored.data(), PageSize));
+    std::mt19937 generator(7);
+    for (auto& byte : page)
+        byte = (unsigned char)generator();
+    assert(LzCompress(page.data(), PageSize, compressed.data(), PageSize - PackedPageBlockSize) == 0);
+
+    auto path = (std::filesystem::temp_directory_path() / "btree_compression_test.db").string();
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + WalFileSuffix);
+    BufferCacheInstance.close();
+    auto failures = BufferCacheInstance.getChecksumFailureCount();
+    auto valueOf = [](int32_t key) { return "{\"name\":\"customer " + std::to_string(key) + "\",\"city\":\"Seattle\",\"status\":\"active\"}"; };
+    auto allocated = [&]() {
+        struct stat status;
+        assert(::stat(path.c_str(), &status) == 0);
+        return std::make_pair((size_t)status.st_blocks * 512, (size_t)status.st_size);
+    };
+
+    // more pages than frames, so most pages are compressed as they are evicted
+    BufferCacheInstance.open(path, 64);
+    BufferCacheInstance.setPageCompression(PageCompression::Evicted);
+    uint32_t leafPid;
+    {
+        BTree<int32_t, std::string> tree;
+        for (int32_t key = 0; key < 20000; key++)
+            tree.insert(key, valueOf(key));
+        BufferCacheInstance.setRootPid(tree.getRootPid());
+        leafPid = tree.find(10000).pid;
+    }
+    BufferCacheInstance.close();
+    assert(BufferCacheInstance.getPackedPageCount() > 0);
+    auto [bytes, fileSize] = allocated();
+    assert(bytes < fileSize * 3 / 4);
+
+    // reads take compressed pages whether or not the cache compresses its writes
+    BufferCacheInstance.open(path, 64);
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        for (int32_t key = 0; key < 20000; key++)
+            assert(tree.find(key).data == valueOf(key));
+        if (BufferCacheInstance.isAsync()) {
+            for (int32_t key = 0; key < 20000; key += 1000) {
+                auto task = tree.findAsync(key);
+                task.start();
+                while (!task.done())
+                    BufferCacheInstance.poll();
+                assert(task.result().data == valueOf(key));
+            }
+        }
+        assert(BufferCacheInstance.getChecksumFailureCount() == failures);
+    }
+    BufferCacheInstance.close();
+
+    // pages that stay cached are written as they are unless every write-back compresses
+    BufferCacheInstance.open(path, 64);
+    BufferCacheInstance.setPageCompression(PageCompression::Evicted);
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        tree.upsert(10000, valueOf(10000));
+        auto packed = BufferCacheInstance.getPackedPageCount();
+        BufferCacheInstance.flush();
+        assert(BufferCacheInstance.getPackedPageCount() == packed);
+        BufferCacheInstance.setPageCompression(PageCompression::All);
+        tree.upsert(10000, valueOf(10000));
+        BufferCacheInstance.flush();
+        assert(BufferCacheInstance.getPackedPageCount() > packed);
+    }
+    BufferCacheInstance.close();
+
+    // checkpoints of a durable cache write compressed copies when every write-back compresses
+    BufferCacheInstance.open(path, 64, true);
+    BufferCacheInstance.setPageCompression(PageCompression::All);
+    auto packed = BufferCacheInstance.getPackedPageCount();
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        for (int32_t key = 0; key < 20000; key += 7)
+            tree.insert(key, valueOf(key + 1));
+        BufferCacheInstance.checkpoint();
+        assert(BufferCacheInstance.getPackedPageCount() > packed);
+    }
+    BufferCacheInstance.close();
+    BufferCacheInstance.open(path, 64);
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        for (int32_t key = 0; key < 20000; key++)
+            assert(tree.find(key).data == valueOf(key % 7 == 0 ? key + 1 : key));
+        leafPid = tree.find(10000).pid;
+    }
+    BufferCacheInstance.close();
+
+    // damage the compressed bytes of a leaf
+    auto fd = ::open(path.c_str(), O_RDWR);
+    BufferPackedPage header;
+    assert(pread(fd, &header, sizeof(header), (off_t)leafPid * PageSize) == sizeof(header) && header._magic == PackedPageMagic);
+    unsigned char byte;
+    auto offset = (off_t)leafPid * PageSize + sizeof(header) + header._size / 2;
+    assert(pread(fd, &byte, 1, offset) == 1);
+    byte ^= 0x5A;
+    assert(pwrite(fd, &byte, 1, offset) == 1);
+    ::close(fd);
+
+    BufferCacheInstance.open(path, 64);
+    {
+        BTree<int32_t, std::string> tree(BufferCacheInstance.getRootPid());
+        auto failed = false;
+        try {
+            tree.find(10000);
+        } catch (const std::runtime_error&) {
+            failed = true;
+        }
+        assert(failed && BufferCacheInstance.getChecksumFailureCount() == failures + 1);
+    }
+    BufferCacheInstance.close();
+    std::filesystem::remove(path);
+
+    std::cout<<"testCompression succeeded"<<"\n";
+}
+
 int main(int argc, const char * argv[]) {
     testSerialization();
+    testCodec();
     testOneNodeOnly();
+    testSplit();
+    testMultiLevelFind();
+    testBulkLoad();
+    testCursor();
+    testRecordFormat();
+    testPrefixCompression();
+    testDenseKeys();
+    testRemove();
+    testDefragment();
+    testMultiGet();
+    testUpsert();
+    testOverflow();
+    testConcurrentUpdates();
+    testPersistence();
+    testEviction();
+    testPageTable();
+    testAsyncFind();
+    testArena();
+    testScan();
+    testRecovery();
+    testCheckpoint();
+    testChecksum();
+    testCompression();
 }
 
@@ -0,0 +1,55 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+BufferCache BufferCacheInstance(64 * 1024);
+
+// About 300MB of leaves, far more than the last level cache
+const int64_t KeyCount = 16 * 1000 * 1000;
+const int64_t LookupCount = 4 * 1000 * 1000;
+
+int main(int argc, const char * argv[]) {
+    std::vector<std::pair<int64_t, int64_t>> items;
+    items.reserve(KeyCount);
+    for (int64_t i = 0; i < KeyCount; i++)
+        items.emplace_back(i * 2, i);
+    BTree<int64_t, int64_t> tree;
+    tree.bulkLoad(items.begin(), items.end());
+    items.clear();
+    items.shrink_to_fit();
+
+    // uniformly random hits, so nearly every lookup misses the cache below the upper levels
+    std::mt19937_64 generator(17);
+    std::vector<int64_t> keys(LookupCount);
+    for (auto& key : keys)
+        key = (int64_t)(generator() % KeyCount) * 2;
+
+    int64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto key : keys)
+        sum += tree.find(key).data;
+    auto end = std::chrono::steady_clock::now();
+    auto find_nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"find of "<<LookupCount<<" keys in microseconds is:"<<find_nano_seconds / 1000<<"\n";
+
+    for (size_t batch : {64, 128, 256, 512}) {
+        std::vector<FindResult<int64_t>> results(batch, FindResult<int64_t>(InvalidPid));
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i + batch <= keys.size(); i += batch) {
+            tree.multiGet(std::span<const int64_t>(keys.data() + i, batch), results);
+            for (auto& result : results)
+                sum -= result.data;
+        }
+        end = std::chrono::steady_clock::now();
+        auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        std::cout<<"multiGet of "<<LookupCount<<" keys in batches of "<<batch<<" in microseconds is:"<<nano_seconds / 1000
+            <<", speedup over find is:"<<(double)find_nano_seconds / nano_seconds<<"x"<<"\n";
+    }
+    std::cout<<"checksum:"<<sum<<"\n";
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+// The large values take 2 overflow pages each, ~20k pages in total
+BufferCache BufferCacheInstance(64 * 1024);
+
+const int64_t KeyCount = 500 * 1000;
+const int LargePercent = 2;
+const size_t SmallValueLength = 64;
+const size_t LargeValueLength = 12 * 1024;
+
+// Number of leaves along the leaf sibling chain
+static uint32_t countLeaves(uint32_t rootPid) {
+    auto node = BTreeInternalNode<int64_t>::getNode(rootPid);
+    while (!node->isLeaf())
+        node = BTreeInternalNode<int64_t>::getNode(node->getChildPid(0));
+
+    uint32_t leaves = 1;
+    for (auto header = node->getHeader(); header->_r_pid != InvalidPid; header = GetPageHeader(header->_r_pid))
+        leaves++;
+    return leaves;
+}
+
+// Insert the keys in order, large ones get a large value unless smallOnly is set. Returns the
+// insert time in nanoseconds.
+static int64_t load(BTree<int64_t, std::string>& tree, const std::vector<int64_t>& keys, const std::vector<bool>& large, bool smallOnly) {
+    std::string small(SmallValueLength, 's');
+    std::string big(LargeValueLength, 'b');
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++)
+        tree.insert(keys[i], large[i] && !smallOnly ? big : small);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+// Look up the keys whose large flag equals wantLarge. Returns the nanoseconds per lookup.
+static int64_t lookup(BTree<int64_t, std::string>& tree, const std::vector<int64_t>& keys, const std::vector<bool>& large, bool wantLarge, size_t* bytes) {
+    uint64_t count = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (large[i] != wantLarge)
+            continue;
+        *bytes += tree.find(keys[i]).data.size();
+        count++;
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / count;
+}
+
+int main(int argc, const char * argv[]) {
+    std::mt19937_64 generator(29);
+    std::vector<int64_t> keys(KeyCount);
+    std::vector<bool> large(KeyCount);
+    for (int64_t i = 0; i < KeyCount; i++) {
+        keys[i] = (int64_t)generator();
+        large[i] = (int)(generator() % 100) < LargePercent;
+    }
+
+    size_t bytes = 0;
+    BTree<int64_t, std::string> mixed;
+    auto nano_seconds = load(mixed, keys, large, false);
+    std::cout<<"inserted "<<KeyCount<<" keys, "<<LargePercent<<"% with "<<LargeValueLength<<" byte values, in "<<nano_seconds / 1000000<<" ms"<<"\n";
+    std::cout<<"mixed tree leaves:"<<countLeaves(mixed.getRootPid())<<", items per leaf:"<<KeyCount / countLeaves(mixed.getRootPid())<<"\n";
+
+    // the same keys with small values only, the mixed tree keeps about the same fan-out
+    BTree<int64_t, std::string> smallOnly;
+    load(smallOnly, keys, large, true);
+    std::cout<<"small value tree leaves:"<<countLeaves(smallOnly.getRootPid())<<", items per leaf:"<<KeyCount / countLeaves(smallOnly.getRootPid())<<"\n";
+
+    std::cout<<"small value find in mixed tree in nanoseconds is:"<<lookup(mixed, keys, large, false, &bytes)<<"\n";
+    std::cout<<"small value find in small value tree in nanoseconds is:"<<lookup(smallOnly, keys, large, false, &bytes)<<"\n";
+    std::cout<<"large value find in mixed tree in nanoseconds is:"<<lookup(mixed, keys, large, true, &bytes)<<"\n";
+    std::cout<<"bytes read:"<<bytes<<"\n";
+
+    return 0;
+}
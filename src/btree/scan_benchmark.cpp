@@ -0,0 +1,58 @@
+#include <chrono>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+
+BufferCache BufferCacheInstance(32 * 1024);
+
+const int32_t KeyCount = 10 * 1000 * 1000;
+const int32_t RangeKeyCount = 1000 * 1000;
+
+int main(int argc, const char * argv[]) {
+    // even keys only, so the range bounds and the point lookups hit every other integer
+    std::vector<std::pair<int32_t, int32_t>> items;
+    items.reserve(KeyCount);
+    for (int32_t i = 0; i < KeyCount; i++)
+        items.emplace_back(i * 2, i);
+
+    BTree<int32_t, int32_t> tree;
+    tree.bulkLoad(items.begin(), items.end());
+
+    auto lo = KeyCount / 2;
+    auto hi = lo + (RangeKeyCount - 1) * 2;
+    int64_t sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    auto count = tree.scan(lo, hi, [&sum](const int32_t& key, const int32_t& value) {
+        sum += value;
+        return true;
+    });
+    auto end = std::chrono::steady_clock::now();
+    auto scan_nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"range scan of "<<count<<" keys in microseconds is:"<<scan_nano_seconds / 1000<<"\n";
+
+    start = std::chrono::steady_clock::now();
+    auto it = tree.cursor();
+    count = 0;
+    for (auto valid = it.seek(hi); valid && it.key() >= lo; valid = it.prev()) {
+        sum -= it.value();
+        count++;
+    }
+    end = std::chrono::steady_clock::now();
+    auto nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"backward range scan of "<<count<<" keys in microseconds is:"<<nano_seconds / 1000<<"\n";
+
+    start = std::chrono::steady_clock::now();
+    for (auto key = lo; key <= hi; key += 2)
+        sum += tree.find(key).data;
+    end = std::chrono::steady_clock::now();
+    auto find_nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"repeated find of "<<RangeKeyCount<<" keys in microseconds is:"<<find_nano_seconds / 1000<<"\n";
+
+    std::cout<<"range scan speedup over repeated find is:"<<(double)find_nano_seconds / scan_nano_seconds<<"x"<<"\n";
+    std::cout<<"checksum:"<<sum<<"\n";
+
+    return 0;
+}
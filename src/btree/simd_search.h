@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Lower bound search over a sorted array of signed 32 or 64 bit integer keys. A binary search
+// narrows the range down to SimdSearchWindow keys, then a vector kernel counts the keys smaller
+// than the probe. The AVX2 or SSE4.2 kernel is picked at runtime, with a scalar fallback.
+
+constexpr int SimdSearchWindow = 32;
+
+enum class SimdLevel {
+    Scalar,
+    Sse42,
+    Avx2,
+};
+
+inline SimdLevel GetSimdLevel() {
+#if defined(__x86_64__)
+    static const SimdLevel level = __builtin_cpu_supports("avx2") ? SimdLevel::Avx2 :
+        __builtin_cpu_supports("sse4.2") ? SimdLevel::Sse42 : SimdLevel::Scalar;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+template <typename T>
+inline int ScalarCountLess(const T* keys, int count, T key) {
+    int less = 0;
+    for (int i = 0; i < count; i++)
+        less += keys[i] < key;
+    return less;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+inline int Avx2CountLess(const int32_t* keys, int count, int32_t key) {
+    auto probe = _mm256_set1_epi32(key);
+    int less = 0, i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        less += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(probe, data))));
+    }
+    return less + ScalarCountLess(keys + i, count - i, key);
+}
+
+__attribute__((target("avx2")))
+inline int Avx2CountLess(const int64_t* keys, int count, int64_t key) {
+    auto probe = _mm256_set1_epi64x(key);
+    int less = 0, i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        less += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(probe, data))));
+    }
+    return less + ScalarCountLess(keys + i, count - i, key);
+}
+
+__attribute__((target("sse4.2")))
+inline int Sse42CountLess(const int32_t* keys, int count, int32_t key) {
+    auto probe = _mm_set1_epi32(key);
+    int less = 0, i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        less += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(probe, data))));
+    }
+    return less + ScalarCountLess(keys + i, count - i, key);
+}
+
+__attribute__((target("sse4.2")))
+inline int Sse42CountLess(const int64_t* keys, int count, int64_t key) {
+    auto probe = _mm_set1_epi64x(key);
+    int less = 0, i = 0;
+    for (; i + 2 <= count; i += 2) {
+        auto data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        less += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(probe, data))));
+    }
+    return less + ScalarCountLess(keys + i, count - i, key);
+}
+#endif
+
+template <typename T>
+inline int CountLess(const T* keys, int count, T key, SimdLevel level) {
+    static_assert(std::is_integral_v<T> && std::is_signed_v<T> && (sizeof(T) == 4 || sizeof(T) == 8),
+                  "Only signed 32 and 64 bit keys are supported");
+#if defined(__x86_64__)
+    // int, long and long long map onto the fixed width kernels by size
+    using TFixed = std::conditional_t<sizeof(T) == 4, int32_t, int64_t>;
+    auto fixedKeys = reinterpret_cast<const TFixed*>(keys);
+    if (level == SimdLevel::Avx2)
+        return Avx2CountLess(fixedKeys, count, (TFixed)key);
+    if (level == SimdLevel::Sse42)
+        return Sse42CountLess(fixedKeys, count, (TFixed)key);
+#endif
+    return ScalarCountLess(keys, count, key);
+}
+
+// Index of the first key >= key
+template <typename T>
+inline int LowerBound(const T* keys, int count, T key, SimdLevel level = GetSimdLevel()) {
+    int low = 0, high = count;
+    while (high - low > SimdSearchWindow) {
+        auto mid = (low + high) / 2;
+        if (keys[mid] < key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low + CountLess(keys + low, high - low, key, level);
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "btree.h"
+#include "buffercache.h"
+#include "test_data.h"
+
+BufferCache BufferCacheInstance(16);
+
+const uint32_t Lookups = 2 * 1000 * 1000;
+
+// The leaf search before in-place key comparison: every probe deserializes the key into a
+// std::string, and the value is copied out on a hit.
+static bool findByDeserialize(BTreeNode<std::string, int32_t>* leaf, const std::string& key, int32_t* value) {
+    auto page = (unsigned char*)leaf;
+    auto slots = reinterpret_cast<uint16_t*>(page + BTreePagerHeaderSize);
+    auto format = leaf->getRecordFormat();
+    auto low = 0, high = leaf->getHeader()->_items_count - 1;
+    while (low <= high) {
+        auto mid = (low + high) / 2;
+        auto midKey = deserialize<std::string>(page + slots[mid], format);
+        if (key > midKey)
+            low = mid + 1;
+        else if (key < midKey)
+            high = mid - 1;
+        else {
+            *value = deserialize<int32_t>(page + slots[mid] + getSerializedSize(midKey, format));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, const char * argv[]) {
+    std::vector<std::string> generated;
+    std::vector<int32_t> unused;
+    generateRandomTestData<std::string, int32_t>(1000, generated, unused);
+    std::sort(generated.begin(), generated.end());
+    generated.erase(std::unique(generated.begin(), generated.end()), generated.end());
+
+    // fill one 8k leaf with as many sorted keys as fit
+    auto leaf = BTreeNode<std::string, int32_t>::newNode(RootNode | LeafNode, InvalidPid);
+    std::vector<std::string> keys;
+    for (auto& key : generated) {
+        if (!leaf->append(key, keys.size(), 1.0))
+            break;
+        keys.push_back(key);
+    }
+    std::cout<<"leaf holds "<<keys.size()<<" random unicode keys"<<"\n";
+
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<size_t> distribution(0, keys.size() - 1);
+    std::vector<uint32_t> probes(Lookups);
+    for (auto& probe : probes)
+        probe = distribution(generator);
+
+    int64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto probe : probes) {
+        int32_t value;
+        if (findByDeserialize(leaf, keys[probe], &value))
+            sum += value;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto before_nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"before: deserialize per probe average lookup in nanoseconds is:"<<before_nano_seconds / Lookups<<"\n";
+
+    start = std::chrono::steady_clock::now();
+    for (auto probe : probes)
+        sum -= leaf->find(keys[probe], false).data;
+    end = std::chrono::steady_clock::now();
+    auto after_nano_seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout<<"after: in-place comparison average lookup in nanoseconds is:"<<after_nano_seconds / Lookups<<"\n";
+
+    std::cout<<"speedup is:"<<(double)before_nano_seconds / after_nano_seconds<<"x"<<"\n";
+    if (sum != 0)
+        throw std::runtime_error("Lookups returned different values");
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// Lazily started coroutine returning T. Awaiting a Task runs it and resumes the awaiting
+// coroutine once it returns. A Task at the top of a chain is started with start() and driven by
+// whatever resumes its awaits, such as BufferCache::poll().
+template<typename T>
+class Task {
+public:
+    struct promise_type {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // hand control to the awaiting coroutine, if any, without growing the stack
+        auto final_suspend() noexcept {
+            struct Continue {
+                bool await_ready() noexcept { return false; }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    auto continuation = handle.promise()._continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+            return Continue{};
+        }
+
+        void return_value(T value) { _value = std::move(value); }
+
+        void unhandled_exception() { _exception = std::current_exception(); }
+
+        std::optional<T> _value;
+        std::exception_ptr _exception;
+        std::coroutine_handle<> _continuation;
+    };
+
+    Task(Task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    // Run until the first await that suspends
+    void start() { _handle.resume(); }
+
+    bool done() const { return _handle.done(); }
+
+    // Value the task returned, rethrowing what it threw. The task must be done.
+    T result() {
+        auto& promise = _handle.promise();
+        if (promise._exception)
+            std::rethrow_exception(promise._exception);
+        return std::move(*promise._value);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        _handle.promise()._continuation = awaiting;
+        return _handle;
+    }
+
+    T await_resume() { return result(); }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "iouring.h"
+
+// The log is written in blocks of this size, records are aligned to WalRecordAlignment
+constexpr uint32_t WalBlockSize = 4096;
+constexpr uint32_t WalRecordAlignment = 8;
+
+enum class WalRecordType : uint32_t {
+    // Payload is the whole page
+    PageImage = 1,
+    // Payload is runs of a uint16_t offset and a uint16_t length followed by the bytes at offset
+    PageDelta = 2,
+    // The page went back to the free list, no payload
+    FreePage = 3,
+    // _pid is the new root PID of the cache, no payload
+    RootPid = 4,
+};
+
+struct WalRecordHeader {
+    // LSN of the record, the log position right after it
+    uint64_t _lsn;
+    // Bytes of the record with its header and padding
+    uint32_t _size;
+    // Of the header with _checksum 0 and of the payload
+    uint32_t _checksum;
+    uint32_t _type;
+    uint32_t _pid;
+    uint32_t _payload_size;
+    uint32_t _reserved;
+};
+
+// Checksum telling a record apart from the garbage after the last record written
+static uint32_t WalChecksum(const unsigned char* data, size_t size, uint64_t seed) {
+    uint64_t hash = seed ^ 0x9E3779B97F4A7C15ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001B3ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001B3ull;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// Redo log of a BufferCache. Records are appended to a buffer and written by group commit:
+// the first thread waiting for its records to be durable writes everything appended so far in
+// one write, the threads arriving meanwhile wait for it and the next write takes all of their
+// records at once. The file is opened with O_DIRECT and O_DSYNC, so a completed write is
+// durable, and written through io_uring when the kernel has it. A LSN is a position in the log,
+// the file holds the log from the LSN it was started at.
+class WriteAheadLog {
+public:
+    WriteAheadLog() = default;
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog() { close(); }
+
+    // Open the log at path, creating it when it doesn't exist, whose first byte is at LSN
+    // startLsn. Appends start there until replay() finds the end of the records.
+    void open(const std::string& path, uint64_t startLsn) {
+        _fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_DIRECT | O_DSYNC, 00666);
+        // file systems such as tmpfs reject O_DIRECT
+        if (_fd < 0 && errno == EINVAL)
+            _fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_DSYNC, 00666);
+        if (_fd < 0)
+            throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+
+        _ring.init(8);
+        reset(startLsn);
+        _writes = 0;
+    }
+
+    void close() {
+        _ring.close();
+        if (_fd >= 0)
+            ::close(_fd);
+        _fd = -1;
+    }
+
+    bool isOpen() const { return _fd >= 0; }
+
+    // Append a record and return its LSN. It is durable once flush() of the LSN returns.
+    uint64_t append(WalRecordType type, uint32_t pid, std::span<const unsigned char> payload) {
+        WalRecordHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header._size = (uint32_t)((sizeof(header) + payload.size() + WalRecordAlignment - 1) / WalRecordAlignment * WalRecordAlignment);
+        header._type = (uint32_t)type;
+        header._pid = pid;
+        header._payload_size = (uint32_t)payload.size();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        header._lsn = _end_lsn + header._size;
+        header._checksum = checksum(header, payload.data());
+        auto offset = _buffer.size();
+        _buffer.resize(offset + header._size);
+        std::memcpy(_buffer.data() + offset, &header, sizeof(header));
+        if (!payload.empty())
+            std::memcpy(_buffer.data() + offset + sizeof(header), payload.data(), payload.size());
+        _end_lsn = header._lsn;
+        return _end_lsn;
+    }
+
+    // Wait until the records up to lsn are durable, writing them when no other thread is
+    void flush(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        lsn = std::min(lsn, _end_lsn);
+        while (_durable_lsn < lsn) {
+            if (_writing) {
+                _written.wait(lock);
+                continue;
+            }
+
+            // the block the durable records end in is written again with the records after them
+            _writing = true;
+            auto start = _buffer_lsn;
+            auto end = _end_lsn;
+            auto size = (size_t)(end - start);
+            auto padded = (size + WalBlockSize - 1) / WalBlockSize * WalBlockSize;
+            reserveWriteBuffer(padded);
+            std::memcpy(_write_buffer.get(), _buffer.data(), size);
+            std::memset(_write_buffer.get() + size, 0, padded - size);
+            lock.unlock();
+            auto error = writeBlocks(padded, start - _start_lsn);
+            lock.lock();
+            _writing = false;
+            _written.notify_all();
+            if (error != 0)
+                throw std::runtime_error(std::string("Failed to write the log: ") + std::strerror(error));
+
+            auto kept = end / WalBlockSize * WalBlockSize;
+            _buffer.erase(_buffer.begin(), _buffer.begin() + (kept - _buffer_lsn));
+            _buffer_lsn = kept;
+            _durable_lsn = end;
+            _writes++;
+        }
+    }
+
+    // Call apply(header, payload) for every record in the file from the one at LSN from, in
+    // order, and continue the log after the last one. The records end where one is torn or was
+    // written by an earlier start. Returns the LSN after the last record.
+    template<typename Apply>
+    uint64_t replay(Apply apply, uint64_t from) {
+        auto fileSize = lseek(_fd, 0, SEEK_END);
+        if (fileSize < 0)
+            throw std::runtime_error(std::string("Failed to read the log: ") + std::strerror(errno));
+        // the blocks before the one holding from may be a hole released by truncateBefore()
+        auto first = (size_t)(from - _start_lsn) / WalBlockSize * WalBlockSize;
+        auto blocks = std::max(((size_t)fileSize + WalBlockSize - 1) / WalBlockSize * WalBlockSize, first) - first;
+        reserveWriteBuffer(blocks);
+        auto data = _write_buffer.get();
+        for (size_t read = 0; read < blocks;) {
+            auto count = pread(_fd, data + read, blocks - read, (off_t)(first + read));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count < 0)
+                throw std::runtime_error(std::string("Failed to read the log: ") + std::strerror(errno));
+            if (count == 0) {
+                std::memset(data + read, 0, blocks - read);
+                break;
+            }
+            read += (size_t)count;
+        }
+
+        auto offset = (size_t)(from - _start_lsn) - first;
+        while (offset + sizeof(WalRecordHeader) <= blocks) {
+            WalRecordHeader header;
+            std::memcpy(&header, data + offset, sizeof(header));
+            if (header._size < sizeof(header) || header._size > blocks - offset || header._payload_size > header._size - sizeof(header)
+                || header._lsn != _start_lsn + first + offset + header._size || header._checksum != checksum(header, data + offset + sizeof(header)))
+                break;
+            // the record is in the file already, pages redone up to it may be written back
+            _end_lsn = _durable_lsn = header._lsn;
+            apply(header, data + offset + sizeof(header));
+            offset += header._size;
+        }
+
+        // the partial block at the end is written again with the next records
+        auto end = _start_lsn + first + offset;
+        _end_lsn = _durable_lsn = end;
+        _buffer_lsn = end / WalBlockSize * WalBlockSize;
+        _buffer.assign(data + (_buffer_lsn - _start_lsn - first), data + offset);
+        return end;
+    }
+
+    // Give the file space of the records before lsn back to the file system. The log keeps its
+    // LSNs, the blocks before lsn read as zeroes.
+    void truncateBefore(uint64_t lsn) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto size = (lsn - _start_lsn) / WalBlockSize * WalBlockSize;
+        // file systems without holes keep the space until the log restarts
+        if (size > _released && fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)_released, (off_t)(size - _released)) == 0)
+            _released = size;
+    }
+
+    // Drop every record and start the log again at lsn, a multiple of WalBlockSize past the
+    // end of the records. No record may be appended meanwhile.
+    void restart(uint64_t lsn) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (ftruncate(_fd, 0) != 0)
+            throw std::runtime_error(std::string("Failed to truncate the log: ") + std::strerror(errno));
+        reset(lsn);
+    }
+
+    uint64_t getEndLsn() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _end_lsn;
+    }
+
+    uint64_t getDurableLsn() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _durable_lsn;
+    }
+
+    // Writes of the log since it was opened, each one committing a group of records
+    uint64_t getWriteCount() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _writes;
+    }
+
+private:
+    void reset(uint64_t lsn) {
+        _start_lsn = _end_lsn = _durable_lsn = _buffer_lsn = lsn;
+        _released = 0;
+        _buffer.clear();
+    }
+
+    static uint32_t checksum(WalRecordHeader header, const unsigned char* payload) {
+        header._checksum = 0;
+        auto seed = WalChecksum(reinterpret_cast<const unsigned char*>(&header), sizeof(header), 0);
+        return WalChecksum(payload, header._payload_size, seed);
+    }
+
+    // O_DIRECT needs the memory, offset and length of a write aligned to the block size
+    void reserveWriteBuffer(size_t size) {
+        if (size <= _write_buffer_size)
+            return;
+        _write_buffer_size = std::max(size, 2 * _write_buffer_size);
+        _write_buffer.reset(static_cast<unsigned char*>(std::aligned_alloc(WalBlockSize, _write_buffer_size)));
+        if (!_write_buffer)
+            throw std::runtime_error("Failed to allocate the log buffer");
+    }
+
+    // Write size bytes of the write buffer at offset of the file. Returns the error, 0 when
+    // the bytes are durable.
+    int writeBlocks(size_t size, uint64_t offset) {
+        for (size_t written = 0; written < size;) {
+            auto data = _write_buffer.get() + written;
+            ssize_t count;
+            if (_ring.isActive()) {
+                _ring.prepare(IORING_OP_WRITE, _fd, data, (uint32_t)(size - written), offset + written, 0, -1);
+                if (!_ring.submit(1))
+                    return errno;
+                count = -EIO;
+                while (_ring.reap([&count](uint64_t, int result) { count = result; }) == 0)
+                    if (!_ring.submit(1))
+                        return errno;
+                if (count < 0)
+                    return (int)-count;
+            } else {
+                count = pwrite(_fd, data, size - written, (off_t)(offset + written));
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count < 0)
+                    return errno;
+            }
+            if (count == 0)
+                return EIO;
+            written += (size_t)count;
+        }
+        return 0;
+    }
+
+    int _fd = -1;
+    // The only writer of the ring is the thread flushing
+    IoRing _ring;
+    std::mutex _mutex;
+    std::condition_variable _written;
+    // LSN of the first byte in the file, and bytes from there given back by truncateBefore()
+    uint64_t _start_lsn = 0;
+    uint64_t _released = 0;
+    // LSN after the last record appended, and after the last one durable
+    uint64_t _end_lsn = 0;
+    uint64_t _durable_lsn = 0;
+    // _buffer holds the log from _buffer_lsn, the start of the block the durable records end in
+    std::vector<unsigned char> _buffer;
+    uint64_t _buffer_lsn = 0;
+    bool _writing = false;
+    std::unique_ptr<unsigned char, decltype(&std::free)> _write_buffer{nullptr, &std::free};
+    size_t _write_buffer_size = 0;
+    uint64_t _writes = 0;
+};